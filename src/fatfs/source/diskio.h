@@ -21,6 +21,13 @@ typedef enum {
 	RES_PARERR		/* 4: Invalid Parameter */
 } DRESULT;
 
+/* Segment of a vectored transfer */
+typedef struct {
+	LBA_t	sector;		/* Start sector in LBA */
+	UINT	count;		/* Number of sectors */
+	BYTE*	buff;		/* Data buffer */
+} DSEG;
+
 
 /*---------------------------------------*/
 /* Prototypes for disk control functions */
@@ -31,12 +38,21 @@ DSTATUS disk_status (BYTE pdrv);
 DRESULT disk_read (BYTE pdrv, BYTE* buff, LBA_t sector, UINT count);
 DRESULT disk_write (BYTE pdrv, const BYTE* buff, LBA_t sector, UINT count);
 DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
+DRESULT disk_readv (BYTE pdrv, const DSEG* seg, UINT nseg);
+DRESULT disk_writev (BYTE pdrv, const DSEG* seg, UINT nseg);
 #else
 DSTATUS disk_initialize (void *pdrv);
 DSTATUS disk_status (void *pdrv);
 DRESULT disk_read (void *pdrv, BYTE* buff, LBA_t sector, UINT count);
 DRESULT disk_write (void *pdrv, const BYTE* buff, LBA_t sector, UINT count);
 DRESULT disk_ioctl (void *pdrv, BYTE cmd, void* buff);
+DRESULT disk_readv (void *pdrv, const DSEG* seg, UINT nseg);
+DRESULT disk_writev (void *pdrv, const DSEG* seg, UINT nseg);
+void* disk_attach (void *dev);
+void disk_detach (void *pdrv);
+DRESULT disk_discard (void *pdrv);
+DRESULT disk_unplug (void *pdrv);
+DRESULT disk_mergestat (void *pdrv, void *stat);
 #endif /* __MS_RTOS__ */
 
 /* Disk Status Bits (DSTATUS) */
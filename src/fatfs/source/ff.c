@@ -21,6 +21,9 @@
 
 #include "ff.h"			/* Declarations of FatFs API */
 #include "diskio.h"		/* Declarations of device I/O functions */
+#if FF_USE_MEMFUNC
+#include <string.h>		/* memcpy(), memset() and memcmp() */
+#endif
 
 
 /*--------------------------------------------------------------------------
@@ -51,12 +54,27 @@
 #define IsSurrogateH(c)	((c) >= 0xD800 && (c) <= 0xDBFF)
 #define IsSurrogateL(c)	((c) >= 0xDC00 && (c) <= 0xDFFF)
 
+/* ASCII character class bitmaps (bit c of the 128-bit map, tested without any table lookup) */
+#define ChrMap(c, m0, m1, m2, m3)	(((c) < 0x40 ? ((c) < 0x20 ? (m0) : (m1)) : ((c) < 0x60 ? (m2) : (m3))) >> ((c) & 0x1F) & 1)
+#define IsLfnBad(c)		ChrMap(c, 0, 0xD4000404, 0, 0x90000000)	/* " * : < > ? | DEL */
+#define IsSfnBad(c)		ChrMap(c, 0, 0x28001800, 0x28000000, 0)	/* + , ; = [ ] */
+
 
 /* Additional file access control and file status flags for internal use */
+#define FA_RESIZED	0x10	/* File size or allocation has been changed */
 #define FA_SEEKEND	0x20	/* Seek to end of the file on file open */
 #define FA_MODIFIED	0x40	/* File has been modified */
 #define FA_DIRTY	0x80	/* FIL.buf[] needs to be written-back */
 
+/* A file opened without sector buffer (FIL.buf is null) transfers whole sectors
+/  between the caller's buffer and the device, its offsets and lengths are sector
+/  aligned */
+#if defined(__MS_RTOS__) && !FF_FS_TINY
+#define DIRECT_IO(fp)	((fp)->buf == 0)
+#else
+#define DIRECT_IO(fp)	0
+#endif
+
 
 /* Additional file attribute bits for internal use */
 #define AM_VOL		0x08	/* Volume label */
@@ -235,6 +253,9 @@
 #if FF_USE_LFN == 1
 #error Static LFN work area cannot be used at thread-safe configuration
 #endif
+#if (FF_FS_RWLOCK || FF_FS_XFER_UNLOCK) && FF_FS_TINY
+#error Shared volume lock and unlocked transfer cannot be used at tiny buffer configuration
+#endif
 #define LEAVE_FF(fs, res)	{ unlock_fs(fs, res); return res; }
 #else
 #define LEAVE_FF(fs, res)	return res
@@ -534,7 +555,15 @@ static WCHAR LfnBuf[FF_MAX_LFN + 1];		/* LFN working buffer */
 #define LEAVE_MKFS(res)	return res
 
 #elif FF_USE_LFN == 3 	/* LFN enabled with dynamic working buffer on the heap */
+#if FF_LFN_VOLBUF		/* The working buffer is provided per volume in fs->lfnbuf */
+#define DEF_NAMBUF
 #if FF_FS_EXFAT
+#define INIT_NAMBUF(fs)	{ (fs)->dirbuf = (BYTE*)((fs)->lfnbuf + FF_MAX_LFN + 1); }
+#else
+#define INIT_NAMBUF(fs)
+#endif
+#define FREE_NAMBUF()
+#elif FF_FS_EXFAT
 #define DEF_NAMBUF		WCHAR *lfn;	/* Pointer to LFN working buffer and directory entry block scratchpad buffer */
 #define INIT_NAMBUF(fs)	{ lfn = ff_memalloc((FF_MAX_LFN+1)*2 + MAXDIRB(FF_MAX_LFN)); if (!lfn) LEAVE_FF(fs, FR_NOT_ENOUGH_CORE); (fs)->lfnbuf = lfn; (fs)->dirbuf = (BYTE*)(lfn+FF_MAX_LFN+1); }
 #define FREE_NAMBUF()	ff_memfree(lfn)
@@ -682,6 +711,11 @@ static void st_qword (BYTE* ptr, QWORD val)	/* Store an 8-byte word in little-en
 /* String functions                                                      */
 /*-----------------------------------------------------------------------*/
 
+#if FF_USE_MEMFUNC
+#define mem_cpy(dst, src, cnt)	memcpy(dst, src, cnt)
+#define mem_set(dst, val, cnt)	memset(dst, val, cnt)
+#define mem_cmp(dst, src, cnt)	memcmp(dst, src, cnt)
+#else
 /* Copy memory to memory */
 static void mem_cpy (void* dst, const void* src, UINT cnt)
 {
@@ -719,14 +753,17 @@ static int mem_cmp (const void* dst, const void* src, UINT cnt)	/* ZR:same, NZ:d
 
 	return r;
 }
+#endif
 
 
+#if !FF_USE_LFN || FF_USE_LABEL
 /* Check if chr is contained in the string */
 static int chk_chr (const char* str, int chr)	/* NZ:contained, ZR:not contained */
 {
 	while (*str && *str != chr) str++;
 	return *str;
 }
+#endif
 
 
 /* Test if the byte is DBC 1st byte */
@@ -794,17 +831,18 @@ static DWORD tchar2uni (	/* Returns a character in UTF-16 encoding (>=0x10000 on
 #elif FF_LFN_UNICODE == 2	/* UTF-8 input */
 	BYTE b;
 	int nf;
+	DWORD lo;
 
 	uc = (BYTE)*p++;	/* Get an encoding unit */
 	if (uc & 0x80) {	/* Multiple byte code? */
 		if ((uc & 0xE0) == 0xC0) {	/* 2-byte sequence? */
-			uc &= 0x1F; nf = 1;
+			uc &= 0x1F; nf = 1; lo = 0x80;
 		} else {
 			if ((uc & 0xF0) == 0xE0) {	/* 3-byte sequence? */
-				uc &= 0x0F; nf = 2;
+				uc &= 0x0F; nf = 2; lo = 0x800;
 			} else {
 				if ((uc & 0xF8) == 0xF0) {	/* 4-byte sequence? */
-					uc &= 0x07; nf = 3;
+					uc &= 0x07; nf = 3; lo = 0x10000;
 				} else {					/* Wrong sequence */
 					return 0xFFFFFFFF;
 				}
@@ -815,7 +853,7 @@ static DWORD tchar2uni (	/* Returns a character in UTF-16 encoding (>=0x10000 on
 			if ((b & 0xC0) != 0x80) return 0xFFFFFFFF;	/* Wrong sequence? */
 			uc = uc << 6 | (b & 0x3F);
 		} while (--nf != 0);
-		if (uc < 0x80 || IsSurrogate(uc) || uc >= 0x110000) return 0xFFFFFFFF;	/* Wrong code? */
+		if (uc < lo || IsSurrogate(uc) || uc >= 0x110000) return 0xFFFFFFFF;	/* Wrong code or overlong sequence? */
 		if (uc >= 0x010000) uc = 0xD800DC00 | ((uc - 0x10000) << 6 & 0x3FF0000) | (uc & 0x3FF);	/* Make a surrogate pair if needed */
 	}
 
@@ -954,6 +992,180 @@ static void unlock_fs (
 	}
 }
 
+
+#if FF_FS_RWLOCK
+/* Shared grant: the holder reads file data and FAT only, and accesses the
+/  sector window in lock_win()/unlock_win() since other shared holders can
+/  move it at the same time */
+static int lock_fs_shared (	/* 1:Ok, 0:timeout */
+	FATFS* fs		/* Filesystem object */
+)
+{
+	return ff_req_grant_shared(fs->sobj);
+}
+
+
+static void unlock_fs_shared (
+	FATFS* fs,		/* Filesystem object */
+	FRESULT res		/* Result code to be returned */
+)
+{
+	if (fs && res != FR_NOT_ENABLED && res != FR_INVALID_DRIVE && res != FR_TIMEOUT) {
+		ff_rel_grant_shared(fs->sobj);
+	}
+}
+
+
+static void lock_win (
+	FATFS* fs		/* Filesystem object */
+)
+{
+	ff_req_window(fs->sobj);
+}
+
+
+static void unlock_win (
+	FATFS* fs		/* Filesystem object */
+)
+{
+	ff_rel_window(fs->sobj);
+}
+#endif
+
+
+#if FF_FS_XFER_UNLOCK
+/* Transfer file data between the device and the caller's buffer with the
+/  volume grant released, so that other tasks can use the volume meanwhile.
+/  The clusters in transfer cannot be freed since remove_chain() waits for
+/  the transfers out of the grant. */
+static FRESULT xfer_unlocked (	/* FR_OK:succeeded, FR_DISK_ERR:transfer failed, FR_TIMEOUT:could not take the grant back */
+	FATFS* fs,		/* Filesystem object */
+	BYTE* buff,		/* Data buffer */
+	LBA_t sect,		/* Start sector */
+	UINT cc,		/* Number of sectors */
+	int wr,			/* 0:read, 1:write */
+	int shr			/* Grant held by the caller (0:exclusive, 1:shared) */
+)
+{
+	DRESULT dr;
+
+
+	ff_rel_grant_xfer(fs->sobj, shr);
+	dr = wr ? disk_write(fs->pdrv, buff, sect, cc) : disk_read(fs->pdrv, buff, sect, cc);
+	if (!ff_req_grant_xfer(fs->sobj, shr)) return FR_TIMEOUT;
+	return (dr == RES_OK) ? FR_OK : FR_DISK_ERR;
+}
+#endif
+
+#endif
+
+
+#if FF_FS_SGIO
+/* Transfer the segments gathered by f_read() or f_write() in one vectored
+/  request, with the volume grant released at FF_FS_XFER_UNLOCK. */
+static FRESULT xfer_segs (	/* FR_OK:succeeded, FR_DISK_ERR:transfer failed, FR_TIMEOUT:could not take the grant back */
+	FATFS* fs,			/* Filesystem object */
+	const DSEG* seg,	/* Segment list */
+	UINT nseg,			/* Number of segments */
+	int wr,				/* 0:read, 1:write */
+	int shr				/* Grant held by the caller (0:exclusive, 1:shared) */
+)
+{
+	DRESULT dr;
+
+
+#if FF_FS_REENTRANT && FF_FS_XFER_UNLOCK
+	ff_rel_grant_xfer(fs->sobj, shr);
+#else
+	(void)shr;
+#endif
+	dr = wr ? disk_writev(fs->pdrv, seg, nseg) : disk_readv(fs->pdrv, seg, nseg);
+#if FF_FS_REENTRANT && FF_FS_XFER_UNLOCK
+	if (!ff_req_grant_xfer(fs->sobj, shr)) return FR_TIMEOUT;
+#endif
+	return (dr == RES_OK) ? FR_OK : FR_DISK_ERR;
+}
+
+
+/* Read the segments gathered by f_read(). The file pointer has been moved
+/  past them, on failure it goes back to the first one so that the next call
+/  redoes the transfers. */
+static FRESULT read_segs (	/* FR_OK:succeeded, FR_DISK_ERR:transfer failed, FR_TIMEOUT:could not take the grant back */
+	FIL* fp,			/* Pointer to the file object */
+	const DSEG* seg,	/* Segment list */
+	UINT nseg,			/* Number of segments */
+	FSIZE_t ofs,		/* File pointer at the first segment */
+	DWORD clst,			/* Current cluster at the first segment */
+	UINT* br			/* Pointer to number of bytes read */
+)
+{
+	FATFS *fs = fp->obj.fs;
+	FRESULT res;
+	UINT i;
+
+
+	res = xfer_segs(fs, seg, nseg, 0, FF_FS_RWLOCK);
+	if (res != FR_OK) {		/* Roll back to the first segment */
+		*br -= (UINT)(fp->fptr - ofs);
+		fp->fptr = ofs;
+		fp->clust = clst;
+	}
+#if !FF_FS_READONLY && FF_FS_MINIMIZE <= 2		/* Replace one of the read sectors with cached data if it contains a dirty sector */
+	for (i = 0; res == FR_OK && i < nseg; i++) {
+#if FF_FS_TINY
+		if (fs->wflag && fs->winsect - seg[i].sector < seg[i].count) {
+			mem_cpy(seg[i].buff + ((fs->winsect - seg[i].sector) * SS(fs)), fs->win, SS(fs));
+		}
+#else
+		if ((fp->flag & FA_DIRTY) && fp->sect - seg[i].sector < seg[i].count) {
+			mem_cpy(seg[i].buff + ((fp->sect - seg[i].sector) * SS(fs)), fp->buf, SS(fs));
+		}
+#endif
+	}
+#else
+	(void)i;
+#endif
+	return res;
+}
+
+
+#if !FF_FS_READONLY
+/* Write the segments gathered by f_write(). The file pointer and size have
+/  been moved past them, on failure they go back to the first one so that
+/  the file never covers sectors that were not written. */
+static FRESULT write_segs (	/* FR_OK:succeeded, FR_DISK_ERR:transfer failed, FR_TIMEOUT:could not take the grant back */
+	FIL* fp,			/* Pointer to the file object */
+	const DSEG* seg,	/* Segment list */
+	UINT nseg,			/* Number of segments */
+	FSIZE_t ofs,		/* File pointer at the first segment */
+	DWORD clst,			/* Current cluster at the first segment */
+	FSIZE_t size,		/* File size at the first segment */
+	UINT* bw			/* Pointer to number of bytes written */
+)
+{
+	FATFS *fs = fp->obj.fs;
+	FRESULT res;
+	UINT i;
+
+
+	res = xfer_segs(fs, seg, nseg, 1, 0);
+	if (res != FR_OK) {		/* Roll back to the first segment */
+		*bw -= (UINT)(fp->fptr - ofs);
+		fp->fptr = ofs;
+		fp->clust = clst;
+		fp->obj.objsize = size;
+		for (i = 0; i < nseg; i++) {	/* Invalidate the sector cache refilled with data not written */
+#if FF_FS_TINY
+			if (fs->winsect - seg[i].sector < seg[i].count) fs->winsect = (LBA_t)0 - 1;
+#else
+			if (fp->sect - seg[i].sector < seg[i].count) fp->sect = 0;
+#endif
+		}
+		if (*bw > 0) fp->flag |= FA_MODIFIED | FA_RESIZED;	/* Keep the bytes written before */
+	}
+	return res;
+}
+#endif
 #endif
 
 
@@ -1076,9 +1288,26 @@ static FRESULT sync_window (	/* Returns FR_OK or FR_DISK_ERR */
 )
 {
 	FRESULT res = FR_OK;
+#if FF_FS_SGIO
+	DSEG seg[2];
+	UINT nseg;
+#endif
 
 
 	if (fs->wflag) {	/* Is the disk access window dirty? */
+#if FF_FS_SGIO
+		seg[0].sector = fs->winsect; seg[0].count = 1; seg[0].buff = fs->win;
+		nseg = 1;
+		if (fs->winsect - fs->fatbase < fs->fsize && fs->n_fats == 2) {	/* Reflect it to 2nd FAT in the same request if needed */
+			seg[1].sector = fs->winsect + fs->fsize; seg[1].count = 1; seg[1].buff = fs->win;
+			nseg = 2;
+		}
+		if (disk_writev(fs->pdrv, seg, nseg) == RES_OK) {	/* Write it back into the volume */
+			fs->wflag = 0;	/* Clear window dirty flag */
+		} else {
+			res = FR_DISK_ERR;
+		}
+#else
 		if (disk_write(fs->pdrv, fs->win, fs->winsect, 1) == RES_OK) {	/* Write it back into the volume */
 			fs->wflag = 0;	/* Clear window dirty flag */
 			if (fs->winsect - fs->fatbase < fs->fsize) {	/* Is it in the 1st FAT? */
@@ -1087,6 +1316,7 @@ static FRESULT sync_window (	/* Returns FR_OK or FR_DISK_ERR */
 		} else {
 			res = FR_DISK_ERR;
 		}
+#endif
 	}
 	return res;
 }
@@ -1135,7 +1365,7 @@ static FRESULT sync_fs (	/* Returns FR_OK or FR_DISK_ERR */
 	if (res == FR_OK) {
 		if (fs->fs_type == FS_FAT32 && fs->fsi_flag == 1) {	/* FAT32: Update FSInfo sector if needed */
 			/* Create FSInfo structure */
-			mem_set(fs->win, 0, sizeof fs->win);
+			mem_set(fs->win, 0, SS(fs));
 			st_word(fs->win + BS_55AA, 0xAA55);
 			st_dword(fs->win + FSI_LeadSig, 0x41615252);
 			st_dword(fs->win + FSI_StrucSig, 0x61417272);
@@ -1462,6 +1692,9 @@ static FRESULT remove_chain (	/* FR_OK(0):succeeded, !=0:error */
 #endif
 
 	if (clst < 2 || clst >= fs->n_fatent) return FR_INT_ERR;	/* Check if in valid range */
+#if FF_FS_REENTRANT && FF_FS_XFER_UNLOCK
+	ff_wait_xfer(fs->sobj);		/* Wait for data transfers out of the grant, they can be on this chain */
+#endif
 
 	/* Mark the previous cluster 'EOC' on the FAT if it exists */
 	if (pclst != 0 && (!FF_FS_EXFAT || fs->fs_type != FS_EXFAT || obj->stat != 2)) {
@@ -1686,7 +1919,7 @@ static FRESULT dir_clear (	/* Returns FR_OK or FR_DISK_ERR */
 	if (sync_window(fs) != FR_OK) return FR_DISK_ERR;	/* Flush disk access window */
 	sect = clst2sect(fs, clst);		/* Top of the cluster */
 	fs->winsect = sect;				/* Set window to top of the cluster */
-	mem_set(fs->win, 0, sizeof fs->win);	/* Clear window buffer */
+	mem_set(fs->win, 0, SS(fs));	/* Clear window buffer */
 #if FF_USE_LFN == 3		/* Quick table clear by using multi-secter write */
 	/* Allocate a temporary buffer */
 	for (szb = ((DWORD)fs->csize * SS(fs) >= MAX_MALLOC) ? MAX_MALLOC : fs->csize * SS(fs), ibuf = 0; szb > SS(fs) && (ibuf = ff_memalloc(szb)) == 0; szb /= 2) ;
@@ -1906,7 +2139,7 @@ static int cmp_lfn (		/* 1:matched, 0:not matched */
 )
 {
 	UINT i, s;
-	WCHAR wc, uc;
+	WCHAR wc, uc, bc;
 
 
 	if (ld_word(dir + LDIR_FstClusLO) != 0) return 0;	/* Check LDIR_FstClusLO */
@@ -1916,8 +2149,14 @@ static int cmp_lfn (		/* 1:matched, 0:not matched */
 	for (wc = 1, s = 0; s < 13; s++) {		/* Process all characters in the entry */
 		uc = ld_word(dir + LfnOfs[s]);		/* Pick an LFN character */
 		if (wc != 0) {
-			if (i >= FF_MAX_LFN + 1 || ff_wtoupper(uc) != ff_wtoupper(lfnbuf[i++])) {	/* Compare it */
-				return 0;					/* Not matched */
+			if (i >= FF_MAX_LFN + 1) return 0;	/* Out of the buffer? */
+			bc = lfnbuf[i++];
+			if (uc != bc) {					/* Compare it (exact match needs no case folding) */
+				if ((uc | bc) < 0x80) {		/* Both are ASCII? */
+					if ((IsLower(uc) ? uc - 0x20 : uc) != (IsLower(bc) ? bc - 0x20 : bc)) return 0;	/* Not matched */
+				} else {
+					if (ff_wtoupper(uc) != ff_wtoupper(bc)) return 0;	/* Not matched */
+				}
 			}
 			wc = uc;
 		} else {
@@ -2449,7 +2688,8 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 	FATFS *fs = dp->obj.fs;
 	BYTE c;
 #if FF_USE_LFN
-	BYTE a, ord, sum;
+	BYTE a, ord, sum, nent;
+	UINT len;
 #endif
 
 	res = dir_sdi(dp, 0);			/* Rewind directory object */
@@ -2477,6 +2717,8 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 	/* On the FAT/FAT32 volume */
 #if FF_USE_LFN
 	ord = sum = 0xFF; dp->blk_ofs = 0xFFFFFFFF;	/* Reset LFN sequence */
+	for (len = 0; fs->lfnbuf[len]; len++) ;
+	nent = (BYTE)((len + 12) / 13);	/* Number of LFN entries the name needs */
 #endif
 	do {
 		res = move_window(fs, dp->sect);
@@ -2493,6 +2735,7 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 					if (c & LLEF) {		/* Is it start of LFN sequence? */
 						sum = dp->dir[LDIR_Chksum];
 						c &= (BYTE)~LLEF; ord = c;	/* LFN start order */
+						if (c != nent && (len % 13 || c != nent + 1)) ord = 0xFF;	/* Reject the sequence without comparing if the length differs */
 						dp->blk_ofs = dp->dptr;	/* Start offset of LFN */
 					}
 					/* Check validity of the LFN entry and compare it with given name */
@@ -2707,6 +2950,11 @@ static void get_fileinfo (
 				if (hs == 0 && IsSurrogate(wc)) {	/* Is it a surrogate? */
 					hs = wc; continue;		/* Get low surrogate */
 				}
+				if (hs == 0 && wc < 0x80) {	/* ASCII is stored as is in any output encoding */
+					if (di >= FF_LFN_BUF) { di = 0; break; }	/* Buffer overflow? */
+					fno->fname[di++] = (TCHAR)wc;
+					continue;
+				}
 				wc = put_utf((DWORD)hs << 16 | wc, &fno->fname[di], FF_LFN_BUF - di);	/* Store it in UTF-16 or UTF-8 encoding */
 				if (wc == 0) { di = 0; break; }	/* Invalid char or buffer overflow? */
 				di += wc;
@@ -2724,6 +2972,11 @@ static void get_fileinfo (
 		if (wc == RDDEM) wc = DDEM;	/* Restore replaced DDEM character */
 		if (si == 9 && di < FF_SFN_BUF) fno->altname[di++] = '.';	/* Insert a . if extension is exist */
 #if FF_LFN_UNICODE >= 1	/* Unicode output */
+		if (wc < 0x80) {			/* ASCII needs no conversion */
+			if (di >= FF_SFN_BUF) { di = 0; break; }	/* Buffer overflow? */
+			fno->altname[di++] = (TCHAR)wc;
+			continue;
+		}
 		if (dbc_1st((BYTE)wc) && si != 8 && si != 11 && dbc_2nd(dp->dir[si])) {	/* Make a DBC if needed */
 			wc = wc << 8 | dp->dir[si++];
 		}
@@ -2874,12 +3127,16 @@ static FRESULT create_name (	/* FR_OK: successful, FR_INVALID_NAME: could not cr
 	/* Create LFN into LFN working buffer */
 	p = *path; lfn = dp->obj.fs->lfnbuf; di = 0;
 	for (;;) {
-		uc = tchar2uni(&p);			/* Get a character */
-		if (uc == 0xFFFFFFFF) return FR_INVALID_NAME;		/* Invalid code or UTF decode error */
-		if (uc >= 0x10000) lfn[di++] = (WCHAR)(uc >> 16);	/* Store high surrogate if needed */
-		wc = (WCHAR)uc;
+		if ((DWORD)*p < 0x80) {		/* ASCII is the same in every API encoding and code page */
+			wc = (WCHAR)*p++;		/* Take it without decoding */
+		} else {
+			uc = tchar2uni(&p);			/* Get a character */
+			if (uc == 0xFFFFFFFF) return FR_INVALID_NAME;		/* Invalid code or UTF decode error */
+			if (uc >= 0x10000) lfn[di++] = (WCHAR)(uc >> 16);	/* Store high surrogate if needed */
+			wc = (WCHAR)uc;
+		}
 		if (wc < ' ' || wc == '/' || wc == '\\') break;	/* Break if end of the path or a separator is found */
-		if (wc < 0x80 && chk_chr("\"*:<>\?|\x7F", wc)) return FR_INVALID_NAME;	/* Reject illegal characters for LFN */
+		if (wc < 0x80 && IsLfnBad(wc)) return FR_INVALID_NAME;	/* Reject illegal characters for LFN */
 		if (di >= FF_MAX_LFN) return FR_INVALID_NAME;	/* Reject too long name */
 		lfn[di++] = wc;					/* Store the Unicode character */
 	}
@@ -2960,7 +3217,7 @@ static FRESULT create_name (	/* FR_OK: successful, FR_INVALID_NAME: could not cr
 			}
 			dp->fn[i++] = (BYTE)(wc >> 8);	/* Put 1st byte */
 		} else {						/* SBC */
-			if (wc == 0 || chk_chr("+,;=[]", wc)) {	/* Replace illegal characters for SFN if needed */
+			if (wc == 0 || (wc < 0x80 && IsSfnBad(wc))) {	/* Replace illegal characters for SFN if needed */
 				wc = '_'; cf |= NS_LOSS | NS_LFN;/* Lossy conversion */
 			} else {
 				if (IsUpper(wc)) {		/* ASCII upper case? */
@@ -3388,6 +3645,9 @@ static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
 	WORD nrsv;
 	FATFS *fs;
 	UINT fmt;
+#if defined(__MS_RTOS__) && FF_MAX_SS != FF_MIN_SS
+	WORD ss;
+#endif
 
 #ifndef __MS_RTOS__
 
@@ -3415,6 +3675,9 @@ static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
 	    }
 	}
 	fs = *rfs;
+#if FF_FS_REENTRANT
+	if (!lock_fs(fs)) return FR_TIMEOUT;	/* Lock the volume */
+#endif
 #endif /* __MS_RTOS__ */
 
 	mode &= (BYTE)~FA_READ;				/* Desired access mode, write access or not */
@@ -3443,8 +3706,15 @@ static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
 		return FR_WRITE_PROTECTED;
 	}
 #if FF_MAX_SS != FF_MIN_SS				/* Get sector size (multiple sector size cfg only) */
+#ifndef __MS_RTOS__
 	if (disk_ioctl(fs->pdrv, GET_SECTOR_SIZE, &SS(fs)) != RES_OK) return FR_DISK_ERR;
 	if (SS(fs) > FF_MAX_SS || SS(fs) < FF_MIN_SS || (SS(fs) & (SS(fs) - 1))) return FR_DISK_ERR;
+#else
+	if (disk_ioctl(fs->pdrv, GET_SECTOR_SIZE, &ss) != RES_OK) return FR_DISK_ERR;
+	if (ss > FF_MAX_SS || ss < FF_MIN_SS || (ss & (ss - 1))) return FR_DISK_ERR;
+	if (SS(fs) != 0 && SS(fs) != ss) return FR_DISK_ERR;	/* File buffers are sized for the sector size of the first mount */
+	SS(fs) = ss;
+#endif /* __MS_RTOS__ */
 #endif
 
 	/* Find an FAT volume on the drive */
@@ -3654,6 +3924,32 @@ static FRESULT validate (	/* Returns FR_OK or FR_INVALID_OBJECT */
 }
 
 
+#if FF_FS_REENTRANT && FF_FS_RWLOCK
+static FRESULT validate_shared (	/* Returns FR_OK or FR_INVALID_OBJECT */
+	FFOBJID* obj,			/* Pointer to the FFOBJID, the 1st member in the FIL/DIR object, to check validity */
+	FATFS** rfs				/* Pointer to pointer to the owner filesystem object to return */
+)
+{
+	FRESULT res = FR_INVALID_OBJECT;
+
+
+	if (obj && obj->fs && obj->fs->fs_type && obj->id == obj->fs->id) {	/* Test if the object is valid */
+		if (lock_fs_shared(obj->fs)) {	/* Obtain the filesystem object in shared mode */
+			if (!(disk_status(obj->fs->pdrv) & STA_NOINIT)) { /* Test if the phsical drive is kept initialized */
+				res = FR_OK;
+			} else {
+				unlock_fs_shared(obj->fs, FR_OK);
+			}
+		} else {
+			res = FR_TIMEOUT;
+		}
+	}
+	*rfs = (res == FR_OK) ? obj->fs : 0;	/* Corresponding filesystem object */
+	return res;
+}
+#endif
+
+
 
 
 /*---------------------------------------------------------------------------
@@ -3767,6 +4063,10 @@ FRESULT f_open (
 
 	if (!fp) return FR_INVALID_OBJECT;
 
+#if defined(__MS_RTOS__) && !FF_FS_TINY
+	if (mode & FA_DIRECT) fp->buf = 0;	/* Open without sector buffer */
+#endif
+
 	/* Get logical drive number */
 	mode &= FF_FS_READONLY ? FA_READ : FA_READ | FA_WRITE | FA_CREATE_ALWAYS | FA_CREATE_NEW | FA_OPEN_ALWAYS | FA_OPEN_APPEND;
 	res = mount_volume(&path, &fs, mode);
@@ -3892,13 +4192,13 @@ FRESULT f_open (
 #endif
 			fp->obj.fs = fs;	 	/* Validate the file object */
 			fp->obj.id = fs->id;
-			fp->flag = mode;		/* Set file access mode */
+			fp->flag = mode & (FA_READ | FA_WRITE | FA_MODIFIED);	/* Set file access mode */
 			fp->err = 0;			/* Clear error flag */
 			fp->sect = 0;			/* Invalidate current data sector */
 			fp->fptr = 0;			/* Set file pointer top of the file */
 #if !FF_FS_READONLY
 #if !FF_FS_TINY
-			mem_set(fp->buf, 0, sizeof fp->buf);	/* Clear sector buffer */
+			if (!DIRECT_IO(fp)) mem_set(fp->buf, 0, SS(fs));	/* Clear sector buffer */
 #endif
 			if ((mode & FA_SEEKEND) && fp->obj.objsize > 0) {	/* Seek to end of file if FA_OPEN_APPEND is specified */
 				fp->fptr = fp->obj.objsize;			/* Offset to seek */
@@ -3910,7 +4210,7 @@ FRESULT f_open (
 					if (clst == 0xFFFFFFFF) res = FR_DISK_ERR;
 				}
 				fp->clust = clst;
-				if (res == FR_OK && ofs % SS(fs)) {	/* Fill sector buffer if not on the sector boundary */
+				if (res == FR_OK && ofs % SS(fs) && !DIRECT_IO(fp)) {	/* Fill sector buffer if not on the sector boundary */
 					sc = clst2sect(fs, clst);
 					if (sc == 0) {
 						res = FR_INT_ERR;
@@ -3940,6 +4240,11 @@ FRESULT f_open (
 /* Read File                                                             */
 /*-----------------------------------------------------------------------*/
 
+#if FF_FS_REENTRANT && FF_FS_RWLOCK	/* f_read() holds the volume in shared mode */
+#undef LEAVE_FF
+#define LEAVE_FF(fs, res)	{ unlock_fs_shared(fs, res); return res; }
+#endif
+
 FRESULT f_read (
 	FIL* fp, 	/* Pointer to the file object */
 	void* buff,	/* Pointer to data buffer */
@@ -3954,18 +4259,35 @@ FRESULT f_read (
 	FSIZE_t remain;
 	UINT rcnt, cc, csect;
 	BYTE *rbuff = (BYTE*)buff;
+#if FF_FS_SGIO || (FF_FS_REENTRANT && FF_FS_XFER_UNLOCK)
+	DWORD pclst;			/* Current cluster before the transfer */
+#endif
+#if FF_FS_SGIO
+	DSEG seg[FF_FS_SGIO];	/* Whole sector transfers gathered for one request */
+	UINT nseg = 0;
+	FSIZE_t sofs = 0;		/* File pointer at the first segment */
+	DWORD sclst = 0;		/* Current cluster at the first segment */
+#endif
 
 
 	*br = 0;	/* Clear read byte counter */
+#if FF_FS_REENTRANT && FF_FS_RWLOCK
+	res = validate_shared(&fp->obj, &fs);		/* Check validity of the file object and share the volume */
+#else
 	res = validate(&fp->obj, &fs);				/* Check validity of the file object */
+#endif
 	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);	/* Check validity */
 	if (!(fp->flag & FA_READ)) LEAVE_FF(fs, FR_DENIED); /* Check access mode */
+	if (DIRECT_IO(fp) && (fp->fptr % SS(fs) || btr % SS(fs))) LEAVE_FF(fs, FR_INVALID_PARAMETER);	/* Check alignment */
 	remain = fp->obj.objsize - fp->fptr;
 	if (btr > remain) btr = (UINT)remain;		/* Truncate btr by remaining bytes */
 
 	for ( ;  btr;								/* Repeat until btr bytes read */
 		btr -= rcnt, *br += rcnt, rbuff += rcnt, fp->fptr += rcnt) {
 		if (fp->fptr % SS(fs) == 0) {			/* On the sector boundary? */
+#if FF_FS_SGIO || (FF_FS_REENTRANT && FF_FS_XFER_UNLOCK)
+			pclst = fp->clust;
+#endif
 			csect = (UINT)(fp->fptr / SS(fs) & (fs->csize - 1));	/* Sector offset in the cluster */
 			if (csect == 0) {					/* On the cluster boundary? */
 				if (fp->fptr == 0) {			/* On the top of the file? */
@@ -3977,7 +4299,13 @@ FRESULT f_read (
 					} else
 #endif
 					{
+#if FF_FS_REENTRANT && FF_FS_RWLOCK
+						lock_win(fs);
+#endif
 						clst = get_fat(&fp->obj, fp->clust);	/* Follow cluster chain on the FAT */
+#if FF_FS_REENTRANT && FF_FS_RWLOCK
+						unlock_win(fs);
+#endif
 					}
 				}
 				if (clst < 2) ABORT(fs, FR_INT_ERR);
@@ -3988,11 +4316,38 @@ FRESULT f_read (
 			if (sect == 0) ABORT(fs, FR_INT_ERR);
 			sect += csect;
 			cc = btr / SS(fs);					/* When remaining bytes >= sector size, */
+			if (DIRECT_IO(fp)) cc = (btr + SS(fs) - 1) / SS(fs);	/* (or the last partial sector without sector buffer) */
 			if (cc > 0) {						/* Read maximum contiguous sectors directly */
 				if (csect + cc > fs->csize) {	/* Clip at cluster boundary */
 					cc = fs->csize - csect;
 				}
+#if FF_FS_SGIO
+				if (nseg > 0 && seg[nseg - 1].sector + seg[nseg - 1].count == sect) {	/* Contiguous to the last segment? */
+					seg[nseg - 1].count += cc;
+				} else {
+					if (nseg == FF_FS_SGIO) {	/* Read the segments if the list is full */
+						res = read_segs(fp, seg, nseg, sofs, sclst, br);
+						if (res == FR_TIMEOUT) LEAVE_FF(fs, res);	/* (Rolled back, the next call redoes the transfers) */
+						if (res != FR_OK) ABORT(fs, res);
+						nseg = 0;
+					}
+					if (nseg == 0) {
+						sofs = fp->fptr; sclst = pclst;
+					}
+					seg[nseg].sector = sect; seg[nseg].count = cc; seg[nseg].buff = rbuff;
+					nseg++;
+				}
+#else
+#if FF_FS_REENTRANT && FF_FS_XFER_UNLOCK
+				res = xfer_unlocked(fs, rbuff, sect, cc, 0, FF_FS_RWLOCK);
+				if (res == FR_TIMEOUT) {		/* Could not take the grant back, step back to redo the transfer at the next call */
+					fp->clust = pclst;
+					LEAVE_FF(fs, res);
+				}
+				if (res != FR_OK) ABORT(fs, res);
+#else
 				if (disk_read(fs->pdrv, rbuff, sect, cc) != RES_OK) ABORT(fs, FR_DISK_ERR);
+#endif
 #if !FF_FS_READONLY && FF_FS_MINIMIZE <= 2		/* Replace one of the read sectors with cached data if it contains a dirty sector */
 #if FF_FS_TINY
 				if (fs->wflag && fs->winsect - sect < cc) {
@@ -4003,8 +4358,10 @@ FRESULT f_read (
 					mem_cpy(rbuff + ((fp->sect - sect) * SS(fs)), fp->buf, SS(fs));
 				}
 #endif
+#endif
 #endif
 				rcnt = SS(fs) * cc;				/* Number of bytes transferred */
+				if (rcnt > btr) rcnt = btr;
 				continue;
 			}
 #if !FF_FS_TINY
@@ -4029,10 +4386,22 @@ FRESULT f_read (
 		mem_cpy(rbuff, fp->buf + fp->fptr % SS(fs), rcnt);	/* Extract partial sector */
 #endif
 	}
+#if FF_FS_SGIO
+	if (nseg > 0) {		/* Read the rest of the segments */
+		res = read_segs(fp, seg, nseg, sofs, sclst, br);
+		if (res == FR_TIMEOUT) LEAVE_FF(fs, res);	/* (Rolled back, the next call redoes the transfers) */
+		if (res != FR_OK) ABORT(fs, res);
+	}
+#endif
 
 	LEAVE_FF(fs, FR_OK);
 }
 
+#if FF_FS_REENTRANT && FF_FS_RWLOCK
+#undef LEAVE_FF
+#define LEAVE_FF(fs, res)	{ unlock_fs(fs, res); return res; }
+#endif
+
 
 
 
@@ -4041,6 +4410,11 @@ FRESULT f_read (
 /* Write File                                                            */
 /*-----------------------------------------------------------------------*/
 
+#if FF_FS_SGIO	/* f_write() writes the gathered segments before leaving on error */
+#undef ABORT
+#define ABORT(fs, res)	{ fp->err = (BYTE)(res); if (nseg > 0 && write_segs(fp, seg, nseg, sofs, sclst, ssize, bw) == FR_TIMEOUT) return (FRESULT)fp->err; LEAVE_FF(fs, (FRESULT)fp->err); }
+#endif
+
 FRESULT f_write (
 	FIL* fp,			/* Pointer to the file object */
 	const void* buff,	/* Pointer to the data to be written */
@@ -4054,21 +4428,38 @@ FRESULT f_write (
 	LBA_t sect;
 	UINT wcnt, cc, csect;
 	const BYTE *wbuff = (const BYTE*)buff;
+	FSIZE_t osize;
+#if FF_FS_SGIO || (FF_FS_REENTRANT && FF_FS_XFER_UNLOCK)
+	DWORD pclst;			/* Current cluster before the transfer */
+#endif
+#if FF_FS_SGIO
+	DSEG seg[FF_FS_SGIO];	/* Whole sector transfers gathered for one request */
+	UINT nseg = 0;
+	FSIZE_t sofs = 0;		/* File pointer at the first segment */
+	DWORD sclst = 0;		/* Current cluster at the first segment */
+	FSIZE_t ssize = 0;		/* File size at the first segment */
+#endif
 
 
 	*bw = 0;	/* Clear write byte counter */
 	res = validate(&fp->obj, &fs);			/* Check validity of the file object */
 	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);	/* Check validity */
 	if (!(fp->flag & FA_WRITE)) LEAVE_FF(fs, FR_DENIED);	/* Check access mode */
+	if (DIRECT_IO(fp) && (fp->fptr % SS(fs) || btw % SS(fs))) LEAVE_FF(fs, FR_INVALID_PARAMETER);	/* Check alignment */
+	osize = fp->obj.objsize;
 
 	/* Check fptr wrap-around (file size cannot reach 4 GiB at FAT volume) */
 	if ((!FF_FS_EXFAT || fs->fs_type != FS_EXFAT) && (DWORD)(fp->fptr + btw) < (DWORD)fp->fptr) {
 		btw = (UINT)(0xFFFFFFFF - (DWORD)fp->fptr);
+		if (DIRECT_IO(fp)) btw -= btw % SS(fs);
 	}
 
 	for ( ;  btw;							/* Repeat until all data written */
 		btw -= wcnt, *bw += wcnt, wbuff += wcnt, fp->fptr += wcnt, fp->obj.objsize = (fp->fptr > fp->obj.objsize) ? fp->fptr : fp->obj.objsize) {
 		if (fp->fptr % SS(fs) == 0) {		/* On the sector boundary? */
+#if FF_FS_SGIO || (FF_FS_REENTRANT && FF_FS_XFER_UNLOCK)
+			pclst = fp->clust;
+#endif
 			csect = (UINT)(fp->fptr / SS(fs)) & (fs->csize - 1);	/* Sector offset in the cluster */
 			if (csect == 0) {				/* On the cluster boundary? */
 				if (fp->fptr == 0) {		/* On the top of the file? */
@@ -4108,7 +4499,37 @@ FRESULT f_write (
 				if (csect + cc > fs->csize) {	/* Clip at cluster boundary */
 					cc = fs->csize - csect;
 				}
+#if FF_FS_SGIO
+				if (nseg > 0 && seg[nseg - 1].sector + seg[nseg - 1].count == sect) {	/* Contiguous to the last segment? */
+					seg[nseg - 1].count += cc;
+				} else {
+					if (nseg == FF_FS_SGIO) {	/* Write the segments if the list is full */
+						res = write_segs(fp, seg, nseg, sofs, sclst, ssize, bw);
+						nseg = 0;
+						if (res == FR_TIMEOUT) LEAVE_FF(fs, res);	/* (Rolled back, the next call redoes the transfers) */
+						if (res != FR_OK) ABORT(fs, res);
+					}
+					if (nseg == 0) {
+						sofs = fp->fptr; sclst = pclst; ssize = fp->obj.objsize;
+					}
+					seg[nseg].sector = sect; seg[nseg].count = cc; seg[nseg].buff = (BYTE*)wbuff;
+					nseg++;
+				}
+#elif FF_FS_REENTRANT && FF_FS_XFER_UNLOCK
+				res = xfer_unlocked(fs, (BYTE*)wbuff, sect, cc, 1, 0);
+				if (res == FR_TIMEOUT) {		/* Could not take the grant back, step back to redo the transfer at the next call */
+					fp->clust = pclst;
+					if (fp->sect - sect < cc) fp->sect = 0;	/* Sector cache overwritten */
+					if (*bw > 0) {				/* Keep the bytes written before */
+						fp->flag |= FA_MODIFIED;
+						if (fp->obj.objsize != osize) fp->flag |= FA_RESIZED;
+					}
+					LEAVE_FF(fs, res);
+				}
+				if (res != FR_OK) ABORT(fs, res);
+#else
 				if (disk_write(fs->pdrv, wbuff, sect, cc) != RES_OK) ABORT(fs, FR_DISK_ERR);
+#endif
 #if FF_FS_MINIMIZE <= 2
 #if FF_FS_TINY
 				if (fs->winsect - sect < cc) {	/* Refill sector cache if it gets invalidated by the direct write */
@@ -4116,7 +4537,7 @@ FRESULT f_write (
 					fs->wflag = 0;
 				}
 #else
-				if (fp->sect - sect < cc) { /* Refill sector cache if it gets invalidated by the direct write */
+				if (!DIRECT_IO(fp) && fp->sect - sect < cc) { /* Refill sector cache if it gets invalidated by the direct write */
 					mem_cpy(fp->buf, wbuff + ((fp->sect - sect) * SS(fs)), SS(fs));
 					fp->flag &= (BYTE)~FA_DIRTY;
 				}
@@ -4150,12 +4571,26 @@ FRESULT f_write (
 		fp->flag |= FA_DIRTY;
 #endif
 	}
+#if FF_FS_SGIO
+	if (nseg > 0) {		/* Write the rest of the segments */
+		res = write_segs(fp, seg, nseg, sofs, sclst, ssize, bw);
+		nseg = 0;
+		if (res == FR_TIMEOUT) LEAVE_FF(fs, res);	/* (Rolled back, the next call redoes the transfers) */
+		if (res != FR_OK) ABORT(fs, res);
+	}
+#endif
 
 	fp->flag |= FA_MODIFIED;				/* Set file change flag */
+	if (fp->obj.objsize != osize) fp->flag |= FA_RESIZED;	/* Set file size change flag if extended */
 
 	LEAVE_FF(fs, FR_OK);
 }
 
+#if FF_FS_SGIO
+#undef ABORT
+#define ABORT(fs, res)		{ fp->err = (BYTE)(res); LEAVE_FF(fs, res); }
+#endif
+
 
 
 
@@ -4166,6 +4601,23 @@ FRESULT f_write (
 FRESULT f_sync (
 	FIL* fp		/* Pointer to the file object */
 )
+{
+	return f_sync_ex(fp, 0);
+}
+
+
+/* With SY_NOFLUSH option, the cached file data is written back but the
+/  directory entry is only updated in the sector window, FSInfo is not
+/  updated and the device cache is not flushed. f_syncfs() completes the job
+/  for every file staged this way, so that concurrent syncs on a volume can
+/  share one device flush. With SY_DATAONLY option, the directory entry is
+/  left as is unless the file size or allocation has been changed, the time
+/  stamp is updated by the next sync without this option. */
+
+FRESULT f_sync_ex (
+	FIL* fp,	/* Pointer to the file object */
+	BYTE opt	/* Sync option (SY_NOFLUSH and/or SY_DATAONLY) */
+)
 {
 	FRESULT res;
 	FATFS *fs;
@@ -4182,6 +4634,10 @@ FRESULT f_sync (
 				fp->flag &= (BYTE)~FA_DIRTY;
 			}
 #endif
+			if ((opt & SY_DATAONLY) && !(fp->flag & FA_RESIZED)) {	/* Leave the time stamp to the next full sync */
+				if (!(opt & SY_NOFLUSH)) res = sync_fs(fs);
+				LEAVE_FF(fs, res);
+			}
 			/* Update the directory entry */
 			tm = GET_FATTIME();				/* Modified time */
 #if FF_FS_EXFAT
@@ -4207,8 +4663,8 @@ FRESULT f_sync (
 						st_dword(fs->dirbuf + XDIR_AccTime, 0);
 						res = store_xdir(&dj);	/* Restore it to the directory */
 						if (res == FR_OK) {
-							res = sync_fs(fs);
-							fp->flag &= (BYTE)~FA_MODIFIED;
+							if (!(opt & SY_NOFLUSH)) res = sync_fs(fs);
+							fp->flag &= (BYTE)~(FA_MODIFIED | FA_RESIZED);
 						}
 					}
 					FREE_NAMBUF();
@@ -4225,8 +4681,8 @@ FRESULT f_sync (
 					st_dword(dir + DIR_ModTime, tm);				/* Update modified time */
 					st_word(dir + DIR_LstAccDate, 0);
 					fs->wflag = 1;
-					res = sync_fs(fs);					/* Restore it to the directory */
-					fp->flag &= (BYTE)~FA_MODIFIED;
+					if (!(opt & SY_NOFLUSH)) res = sync_fs(fs);	/* Restore it to the directory */
+					fp->flag &= (BYTE)~(FA_MODIFIED | FA_RESIZED);
 				}
 			}
 		}
@@ -4235,6 +4691,74 @@ FRESULT f_sync (
 	LEAVE_FF(fs, res);
 }
 
+
+
+
+#ifdef __MS_RTOS__
+/*-----------------------------------------------------------------------*/
+/* Write Back and Reload the Sector Buffer                               */
+/*-----------------------------------------------------------------------*/
+/* Keeps the sector buffer of a file coherent with direct transfers made
+/  through another file object: the dirty buffer is written back before
+/  them, and reloaded after a direct write. */
+
+FRESULT f_syncbuf (
+	FIL* fp,	/* Pointer to the file object */
+	BYTE reload	/* 1:Reload the buffer after the write-back */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+
+
+	res = validate(&fp->obj, &fs);	/* Check validity of the file object */
+#if !FF_FS_TINY
+	if (res == FR_OK && !DIRECT_IO(fp)) {
+		if (fp->flag & FA_DIRTY) {	/* Write-back cached data if needed */
+			if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) LEAVE_FF(fs, FR_DISK_ERR);
+			fp->flag &= (BYTE)~FA_DIRTY;
+		}
+		if (reload && fp->sect != 0) {	/* Reload the cached sector */
+			if (disk_read(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);	/* The buffer is lost */
+		}
+	}
+#endif
+
+	LEAVE_FF(fs, res);
+}
+#endif /* __MS_RTOS__ */
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Synchronize the Volume                                                */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_syncfs (
+#ifdef __MS_RTOS__
+	FATFS* fs			/* Pointer to the filesystem object */
+#else
+	const TCHAR* path	/* Logical drive number */
+#endif /* __MS_RTOS__ */
+)
+{
+	FRESULT res;
+#ifdef __MS_RTOS__
+	const TCHAR *path = _T("");
+#else
+	FATFS *fs;
+#endif /* __MS_RTOS__ */
+
+
+	res = mount_volume(&path, &fs, 0);	/* Get logical drive */
+	if (res == FR_OK) {
+		res = sync_fs(fs);				/* Write back the window and FSInfo, and flush the device cache */
+	}
+
+	LEAVE_FF(fs, res);
+}
+
 #endif /* !FF_FS_READONLY */
 
 
@@ -4518,7 +5042,7 @@ FRESULT f_lseek (
 				dsc = clst2sect(fs, fp->clust);
 				if (dsc == 0) ABORT(fs, FR_INT_ERR);
 				dsc += (DWORD)((ofs - 1) / SS(fs)) & (fs->csize - 1);
-				if (fp->fptr % SS(fs) && dsc != fp->sect) {	/* Refill sector cache if needed */
+				if (fp->fptr % SS(fs) && dsc != fp->sect && !DIRECT_IO(fp)) {	/* Refill sector cache if needed */
 #if !FF_FS_TINY
 #if !FF_FS_READONLY
 					if (fp->flag & FA_DIRTY) {		/* Write-back dirty sector cache */
@@ -4571,7 +5095,7 @@ FRESULT f_lseek (
 					if (fp->flag & FA_WRITE) {			/* Check if in write mode or not */
 						if (FF_FS_EXFAT && fp->fptr > fp->obj.objsize) {	/* No FAT chain object needs correct objsize to generate FAT value */
 							fp->obj.objsize = fp->fptr;
-							fp->flag |= FA_MODIFIED;
+							fp->flag |= FA_MODIFIED | FA_RESIZED;
 						}
 						clst = create_chain(&fp->obj, clst);	/* Follow chain with forceed stretch */
 						if (clst == 0) {				/* Clip file size in case of disk full */
@@ -4596,9 +5120,9 @@ FRESULT f_lseek (
 		}
 		if (!FF_FS_READONLY && fp->fptr > fp->obj.objsize) {	/* Set file change flag if the file size is extended */
 			fp->obj.objsize = fp->fptr;
-			fp->flag |= FA_MODIFIED;
+			fp->flag |= FA_MODIFIED | FA_RESIZED;
 		}
-		if (fp->fptr % SS(fs) && nsect != fp->sect) {	/* Fill sector cache if needed */
+		if (fp->fptr % SS(fs) && nsect != fp->sect && !DIRECT_IO(fp)) {	/* Fill sector cache if needed */
 #if !FF_FS_TINY
 #if !FF_FS_READONLY
 			if (fp->flag & FA_DIRTY) {			/* Write-back dirty sector cache */
@@ -4754,6 +5278,55 @@ FRESULT f_readdir (
 
 
 
+#if FF_USE_READDIR_BATCH
+/*-----------------------------------------------------------------------*/
+/* Read Directory Entries in Batch                                       */
+/*-----------------------------------------------------------------------*/
+/* Items are passed to func() one by one under a single volume lock. When
+/  func() returns zero, the item is not consumed and will be returned first
+/  on the next call. */
+
+FRESULT f_readdir_batch (
+	DIR* dp,			/* Pointer to the open directory object */
+	FILINFO* fno,		/* Pointer to file information work area */
+	UINT (*func)(const FILINFO*, void*),	/* Callback to take an item (0:no room) */
+	void* arg,			/* Argument passed to func() */
+	UINT* nr			/* Pointer to number of items taken */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DEF_NAMBUF
+
+
+	*nr = 0;	/* Initialize item counter */
+	if (!fno || !func) return FR_INVALID_PARAMETER;
+	res = validate(&dp->obj, &fs);	/* Check validity of the directory object */
+	if (res == FR_OK) {
+		INIT_NAMBUF(fs);
+		for (;;) {
+			res = DIR_READ_FILE(dp);		/* Read an item */
+			if (res != FR_OK) break;		/* End of directory or error */
+			get_fileinfo(dp, fno);			/* Get the object information */
+			if (!func(fno, arg)) {			/* Leave the item for next call if no room */
+#if FF_USE_LFN
+				if (dp->blk_ofs != 0xFFFFFFFF) res = dir_sdi(dp, dp->blk_ofs);	/* Back to the top of the entry block */
+#endif
+				break;
+			}
+			(*nr)++;
+			res = dir_next(dp, 0);			/* Increment index for next */
+			if (res != FR_OK) break;
+		}
+		if (res == FR_NO_FILE) res = FR_OK;	/* Ignore end of directory */
+		FREE_NAMBUF();
+	}
+	LEAVE_FF(fs, res);
+}
+#endif
+
+
+
 #if FF_USE_FIND
 /*-----------------------------------------------------------------------*/
 /* Find Next File                                                        */
@@ -4974,7 +5547,7 @@ FRESULT f_truncate (
 			}
 		}
 		fp->obj.objsize = fp->fptr;	/* Set file size to current read/write point */
-		fp->flag |= FA_MODIFIED;
+		fp->flag |= FA_MODIFIED | FA_RESIZED;
 #if !FF_FS_TINY
 		if (res == FR_OK && (fp->flag & FA_DIRTY)) {
 			if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) {
@@ -5092,6 +5665,322 @@ FRESULT f_unlink (
 
 
 
+#if FF_USE_RMTREE
+#if FF_FS_EXFAT
+#error f_rmtree() does not support exFAT volume
+#endif
+/*-----------------------------------------------------------------------*/
+/* Remove a File or a Directory Tree                                     */
+/*-----------------------------------------------------------------------*/
+/* The object is detached from its parent directory first, then the tree
+/  is walked depth-first and only the cluster chains are freed. Entries in
+/  the removed directories are not rewritten because their clusters are
+/  freed as a whole. An interruption can leave lost clusters but never a
+/  reference to a freed cluster. Open objects in the tree must be closed
+/  by the application. */
+
+#define RMTREE_DEPTH	16		/* Number of directory levels held on the stack */
+#define RMTREE_NCHAIN	32		/* Number of chains freed in a batch */
+
+static FRESULT rmtree_free (	/* Free the pending chains */
+	DIR* dp,			/* Any directory object on the volume */
+	DWORD* chain,		/* Start clusters of the pending chains */
+	UINT* nc			/* Number of pending chains (cleared) */
+)
+{
+	FRESULT res = FR_OK;
+	UINT i;
+
+
+	for (i = 0; i < *nc && res == FR_OK; i++) {
+		res = remove_chain(&dp->obj, chain[i], 0);
+	}
+	*nc = 0;
+	return res;
+}
+
+
+static FRESULT rmtree_up (	/* Move to the entry next to the sub-directory in its parent */
+	DIR* dp,			/* Directory object of the sub-directory */
+	DWORD pclst,		/* Start cluster of the parent directory (0:get it from the dot-dot entry) */
+	DWORD ofs			/* Offset of the sub-directory entry in the parent (ignored if pclst is 0) */
+)
+{
+	FRESULT res;
+	DWORD clst = dp->obj.sclust;
+
+
+	if (pclst == 0) {	/* The level is not on the stack, find it in the parent directory */
+		res = dir_sdi(dp, SZDIRE);						/* Get the dot-dot entry */
+		if (res == FR_OK) res = move_window(dp->obj.fs, dp->sect);
+		if (res != FR_OK) return res;
+		pclst = ld_clust(dp->obj.fs, dp->dir);
+		if (pclst == 0) return FR_INT_ERR;
+		dp->obj.sclust = pclst;
+		res = dir_sdi(dp, 0);
+		while (res == FR_OK) {
+			res = dir_read(dp, 0);
+			if (res == FR_OK && (dp->obj.attr & AM_DIR) && ld_clust(dp->obj.fs, dp->dir) == clst) break;
+			if (res == FR_OK) res = dir_next(dp, 0);
+		}
+		if (res == FR_NO_FILE) res = FR_INT_ERR;	/* The sub-directory has gone */
+	} else {
+		dp->obj.sclust = pclst;
+		res = dir_sdi(dp, ofs);
+	}
+	if (res == FR_OK) res = dir_next(dp, 0);
+	if (res == FR_NO_FILE) res = FR_OK;		/* End of the parent is detected by next dir_read() */
+	return res;
+}
+
+
+FRESULT f_rmtree (
+#ifdef __MS_RTOS__
+    FATFS *fs,
+#endif /* __MS_RTOS__ */
+	const TCHAR* path		/* Pointer to the file or directory path */
+)
+{
+	FRESULT res;
+	DIR dj, sdj;
+	DWORD dclst = 0, clst;
+#ifndef __MS_RTOS__
+	FATFS *fs;
+#endif /* __MS_RTOS__ */
+	DWORD stk[RMTREE_DEPTH][2];		/* {parent start cluster, entry offset} of each level */
+	DWORD chain[RMTREE_NCHAIN];
+	UINT depth = 0, nc = 0;
+	DEF_NAMBUF
+
+
+	/* Get logical drive */
+	res = mount_volume(&path, &fs, FA_WRITE);
+	if (res == FR_OK) {
+		dj.obj.fs = fs;
+		INIT_NAMBUF(fs);
+		res = follow_path(&dj, path);		/* Follow the file path */
+		if (FF_FS_RPATH && res == FR_OK && (dj.fn[NSFLAG] & NS_DOT)) {
+			res = FR_INVALID_NAME;			/* Cannot remove dot entry */
+		}
+#if FF_FS_LOCK != 0
+		if (res == FR_OK) res = chk_lock(&dj, 2);	/* Check if it is an open object */
+#endif
+		if (res == FR_OK) {					/* The object is accessible */
+			if (dj.fn[NSFLAG] & NS_NONAME) {
+				res = FR_INVALID_NAME;		/* Cannot remove the origin directory */
+			} else {
+				if (dj.obj.attr & AM_RDO) {
+					res = FR_DENIED;		/* Cannot remove R/O object */
+				}
+			}
+#if FF_FS_RPATH != 0
+			if (res == FR_OK && (dj.obj.attr & AM_DIR) && ld_clust(fs, dj.dir) == fs->cdir) {
+				res = FR_DENIED;			/* Cannot remove the current directory */
+			}
+#endif
+		}
+		if (res == FR_OK) {
+			dclst = ld_clust(fs, dj.dir);
+			res = dir_remove(&dj);			/* Detach the object from the parent directory */
+		}
+		if (res == FR_OK && dclst != 0) {
+			if (dj.obj.attr & AM_DIR) {		/* Walk the tree and free the chains */
+				sdj.obj.fs = fs;
+				sdj.obj.sclust = dclst;
+				res = dir_sdi(&sdj, 0);
+				while (res == FR_OK) {
+					res = dir_read(&sdj, 0);	/* Get an item */
+					if (res == FR_OK) {
+						clst = ld_clust(fs, sdj.dir);
+						if (sdj.obj.attr & AM_DIR) {	/* A sub-directory: go down into it */
+							if (clst == 0 || depth >= fs->n_fatent) {	/* Broken or looped tree? */
+								res = FR_INT_ERR; break;
+							}
+							if (depth < RMTREE_DEPTH) {
+								stk[depth][0] = sdj.obj.sclust;
+								stk[depth][1] = sdj.dptr;
+							}
+							depth++;
+							sdj.obj.sclust = clst;
+							res = dir_sdi(&sdj, 0);
+						} else {						/* A file: queue its chain */
+							if (clst != 0) chain[nc++] = clst;
+							res = dir_next(&sdj, 0);
+							if (res == FR_NO_FILE) res = FR_OK;
+						}
+					} else if (res == FR_NO_FILE) {		/* End of the directory: go back up */
+						clst = sdj.obj.sclust;
+						res = FR_OK;
+						if (depth == 0) {
+							chain[nc++] = clst;
+							break;
+						}
+						depth--;
+						res = (depth < RMTREE_DEPTH) ? rmtree_up(&sdj, stk[depth][0], stk[depth][1]) : rmtree_up(&sdj, 0, 0);
+						chain[nc++] = clst;		/* The directory is no longer read */
+					}
+					if (res == FR_OK && nc == RMTREE_NCHAIN) res = rmtree_free(&sdj, chain, &nc);
+				}
+				if (res == FR_OK) res = rmtree_free(&sdj, chain, &nc);
+			} else {
+				res = remove_chain(&dj.obj, dclst, 0);
+			}
+		}
+		if (res == FR_OK) res = sync_fs(fs);
+		FREE_NAMBUF();
+	}
+
+	LEAVE_FF(fs, res);
+}
+#endif /* FF_USE_RMTREE */
+
+
+
+
+#if FF_USE_COMPACTDIR
+#if FF_FS_EXFAT
+#error f_compactdir() does not support exFAT volume
+#endif
+/*-----------------------------------------------------------------------*/
+/* Compact a Directory                                                   */
+/*-----------------------------------------------------------------------*/
+/* Live entries are moved toward the top of the directory in order, so that
+/  the LFN sequences are kept intact, and the clusters left unused are freed.
+/  Nothing is done if the number of deleted entries is less than thr. Objects
+/  in the directory must not be open during the compaction, busy() is called
+/  with each sector of the directory to tell if an open file has its entry in
+/  it, and the directory is left as is if any has. */
+
+static FRESULT compact_put (	/* Write a sector image to the directory and go to the next sector */
+	DIR* dp,			/* Directory object pointing the top of the sector */
+	const BYTE* buf		/* Sector image */
+)
+{
+	FRESULT res;
+	FATFS *fs = dp->obj.fs;
+	UINT i;
+
+
+	res = sync_window(fs);				/* Flush disk access window */
+	if (res == FR_OK) {
+		fs->winsect = dp->sect;			/* The sector is overwritten entirely, no need to read it */
+		mem_cpy(fs->win, buf, SS(fs));
+		fs->wflag = 1;
+		for (i = 0; i < SS(fs) / SZDIRE && res == FR_OK; i++) {
+			res = dir_next(dp, 0);
+		}
+	}
+	return res;
+}
+
+
+FRESULT f_compactdir (
+#ifdef __MS_RTOS__
+    FATFS *fs,
+#endif /* __MS_RTOS__ */
+	const TCHAR* path,	/* Pointer to the directory path */
+	UINT thr,			/* Minimum number of deleted entries to compact the directory */
+	void* work,			/* Pointer to the working buffer (sector size) */
+	UINT (*busy)(DWORD, LBA_t, void*),	/* Callback to tell if the directory (start cluster) or a sector of it is in use (1:busy), NULL:none */
+	void* arg			/* Argument passed to busy() */
+)
+{
+	FRESULT res;
+	DIR dj, wj;
+	BYTE *buf = (BYTE*)work, b;
+	UINT ndel = 0, n = 0, nent;
+	LBA_t sect, esect = 0;
+	DWORD clst, nxt;
+#ifndef __MS_RTOS__
+	FATFS *fs;
+#endif /* __MS_RTOS__ */
+	DEF_NAMBUF
+
+
+	if (!buf) return FR_INVALID_PARAMETER;
+
+	/* Get logical drive */
+	res = mount_volume(&path, &fs, FA_WRITE);
+	if (res == FR_OK) {
+		dj.obj.fs = fs;
+		INIT_NAMBUF(fs);
+		res = follow_path(&dj, path);			/* Follow the path to the directory */
+		if (res == FR_OK) {
+			if (!(dj.fn[NSFLAG] & NS_NONAME)) {	/* It is not the origin directory itself */
+				if (dj.obj.attr & AM_DIR) {
+					dj.obj.sclust = ld_clust(fs, dj.dir);
+				} else {
+					res = FR_NO_PATH;
+				}
+			}
+		}
+		if (res == FR_OK) res = dir_sdi(&dj, 0);
+		while (res == FR_OK) {					/* Count the deleted entries */
+			res = move_window(fs, dj.sect);
+			if (res != FR_OK) break;
+			if (busy && dj.sect != esect && busy(dj.obj.sclust, dj.sect, arg)) {	/* The directory is open or an open file has its entry in the sector */
+				res = FR_LOCKED;
+				break;
+			}
+			esect = dj.sect;					/* Last sector in use */
+			b = dj.dir[DIR_Name];
+			if (b == 0) break;					/* End of the directory */
+			if (b == DDEM) ndel++;
+			res = dir_next(&dj, 0);
+		}
+		if (res == FR_NO_FILE) res = FR_OK;
+
+		if (res == FR_OK && ndel > 0 && ndel >= thr) {
+			nent = SS(fs) / SZDIRE;
+			res = dir_sdi(&dj, 0);
+			mem_cpy(&wj, &dj, sizeof (DIR));	/* Write pointer follows the read pointer */
+			while (res == FR_OK) {				/* Move the live entries */
+				res = move_window(fs, dj.sect);
+				if (res != FR_OK) break;
+				b = dj.dir[DIR_Name];
+				if (b == 0) break;
+				if (b != DDEM) {
+					mem_cpy(buf + n * SZDIRE, dj.dir, SZDIRE);
+					if (++n == nent) {			/* A sector image is completed */
+						res = compact_put(&wj, buf);
+						n = 0;
+					}
+				}
+				if (res == FR_OK) res = dir_next(&dj, 0);
+			}
+			if (res == FR_NO_FILE) res = FR_OK;
+			if (res == FR_OK && wj.sect != 0) {	/* Terminate the directory and clear the stale entries in the last cluster */
+				clst = wj.clust;
+				mem_set(buf + n * SZDIRE, 0, (nent - n) * SZDIRE);
+				do {
+					sect = wj.sect;
+					res = compact_put(&wj, buf);
+					mem_set(buf, 0, SS(fs));
+				} while (res == FR_OK && sect != esect && wj.clust == clst);
+				if (res == FR_NO_FILE) res = FR_OK;
+				if (res == FR_OK && clst != 0) {	/* Free the clusters following the last one */
+					nxt = get_fat(&dj.obj, clst);
+					if (nxt == 1) {
+						res = FR_INT_ERR;
+					} else if (nxt == 0xFFFFFFFF) {
+						res = FR_DISK_ERR;
+					} else if (nxt >= 2 && nxt < fs->n_fatent) {
+						res = remove_chain(&dj.obj, nxt, clst);
+					}
+				}
+			}
+			if (res == FR_OK) res = sync_fs(fs);
+		}
+		FREE_NAMBUF();
+	}
+
+	LEAVE_FF(fs, res);
+}
+#endif /* FF_USE_COMPACTDIR */
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Create a Directory                                                    */
 /*-----------------------------------------------------------------------*/
@@ -5192,14 +6081,41 @@ FRESULT f_rename (
 	const TCHAR* path_old,	/* Pointer to the object name to be renamed */
 	const TCHAR* path_new	/* Pointer to the new name */
 )
+{
+#ifdef __MS_RTOS__
+	return f_rename_ex(fs, path_old, path_new, 0, 0, 0);
+#else
+	return f_rename_ex(path_old, path_new, 0, 0, 0);
+#endif /* __MS_RTOS__ */
+}
+
+
+/* With RN_REPLACE option, an existing object at the new name is replaced in
+/  the same operation. The replaced directory needs to be empty, a file only
+/  replaces a file and a directory only a directory (FR_EXIST). The replaced
+/  entry keeps its name and takes over the rest from the old object. The busy
+/  callback can refuse to replace an object in use (FR_LOCKED). (FAT/FAT32
+/  volume only) */
+
+FRESULT f_rename_ex (
+#ifdef __MS_RTOS__
+    FATFS *fs,
+#endif /* __MS_RTOS__ */
+	const TCHAR* path_old,	/* Pointer to the object name to be renamed */
+	const TCHAR* path_new,	/* Pointer to the new name */
+	BYTE opt,				/* Rename option (RN_REPLACE: Replace existing object) */
+	UINT (*busy)(LBA_t, const BYTE*, DWORD, void*),	/* Callback to tell if the object to be replaced (entry sector and pointer, start cluster) is in use (1:busy), NULL:none */
+	void* arg				/* Argument passed to busy() */
+)
 {
 	FRESULT res;
-	DIR djo, djn;
+	DIR djo, djn, sdj;
 #ifndef __MS_RTOS__
 	FATFS *fs;
 #endif /* __MS_RTOS__ */
 	BYTE buf[FF_FS_EXFAT ? SZDIRE * 2 : SZDIRE], *dir;
 	LBA_t sect;
+	DWORD dclst = 0;
 	DEF_NAMBUF
 
 
@@ -5251,24 +6167,47 @@ FRESULT f_rename (
 				}
 				if (res == FR_NO_FILE) { 				/* It is a valid path and no name collision */
 					res = dir_register(&djn);			/* Register the new entry */
+				} else if (res == FR_EXIST && (opt & RN_REPLACE)) {	/* Replace the existing object */
+					res = ((djn.obj.attr ^ buf[DIR_Attr]) & AM_DIR) ? FR_EXIST : FR_OK;	/* Cannot replace a file with a directory or a directory with a file */
+					if (res == FR_OK && (djn.obj.attr & AM_RDO)) res = FR_DENIED;	/* Cannot replace R/O object */
+#if FF_FS_LOCK != 0
+					if (res == FR_OK) res = chk_lock(&djn, 2);
+#endif
 					if (res == FR_OK) {
-						dir = djn.dir;					/* Copy directory entry of the object except name */
-						mem_cpy(dir + 13, buf + 13, SZDIRE - 13);
-						dir[DIR_Attr] = buf[DIR_Attr];
-						if (!(dir[DIR_Attr] & AM_DIR)) dir[DIR_Attr] |= AM_ARC;	/* Set archive attribute if it is a file */
-						fs->wflag = 1;
-						if ((dir[DIR_Attr] & AM_DIR) && djo.obj.sclust != djn.obj.sclust) {	/* Update .. entry in the sub-directory if needed */
-							sect = clst2sect(fs, ld_clust(fs, dir));
-							if (sect == 0) {
-								res = FR_INT_ERR;
-							} else {
+						dclst = ld_clust(fs, djn.dir);	/* Chain of the object to be replaced */
+						if (busy && busy(djn.sect, djn.dir, dclst, arg)) res = FR_LOCKED;	/* The object is open */
+					}
+					if (res == FR_OK) {
+						if ((djn.obj.attr & AM_DIR) && dclst != 0) {	/* Test if the directory is empty */
+							sdj.obj.fs = fs;
+							sdj.obj.sclust = dclst;
+							res = dir_sdi(&sdj, 0);
+							if (res == FR_OK) {
+								res = DIR_READ_FILE(&sdj);
+								if (res == FR_OK) res = FR_DENIED;	/* Not empty? */
+								if (res == FR_NO_FILE) res = FR_OK;	/* Empty? */
+							}
+							if (res == FR_OK) res = move_window(fs, djn.sect);	/* Reload the entry to be replaced */
+						}
+					}
+				}
+				if (res == FR_OK) {
+					dir = djn.dir;					/* Copy directory entry of the object except name */
+					mem_cpy(dir + 13, buf + 13, SZDIRE - 13);
+					dir[DIR_Attr] = buf[DIR_Attr];
+					if (!(dir[DIR_Attr] & AM_DIR)) dir[DIR_Attr] |= AM_ARC;	/* Set archive attribute if it is a file */
+					fs->wflag = 1;
+					if ((dir[DIR_Attr] & AM_DIR) && djo.obj.sclust != djn.obj.sclust) {	/* Update .. entry in the sub-directory if needed */
+						sect = clst2sect(fs, ld_clust(fs, dir));
+						if (sect == 0) {
+							res = FR_INT_ERR;
+						} else {
 /* Start of critical section where an interruption can cause a cross-link */
-								res = move_window(fs, sect);
-								dir = fs->win + SZDIRE * 1;	/* Ptr to .. entry */
-								if (res == FR_OK && dir[1] == '.') {
-									st_clust(fs, dir, djn.obj.sclust);
-									fs->wflag = 1;
-								}
+							res = move_window(fs, sect);
+							dir = fs->win + SZDIRE * 1;	/* Ptr to .. entry */
+							if (res == FR_OK && dir[1] == '.') {
+								st_clust(fs, dir, djn.obj.sclust);
+								fs->wflag = 1;
 							}
 						}
 					}
@@ -5276,6 +6215,9 @@ FRESULT f_rename (
 			}
 			if (res == FR_OK) {
 				res = dir_remove(&djo);		/* Remove old entry */
+				if (res == FR_OK && dclst != 0) {
+					res = remove_chain(&djo.obj, dclst, 0);	/* Free the chain of the replaced object */
+				}
 				if (res == FR_OK) {
 					res = sync_fs(fs);
 				}
@@ -5679,7 +6621,7 @@ FRESULT f_expand (
 			fp->obj.sclust = scl;		/* Update object allocation information */
 			fp->obj.objsize = fsz;
 			if (FF_FS_EXFAT) fp->obj.stat = 2;	/* Set status 'contiguous chain' */
-			fp->flag |= FA_MODIFIED;
+			fp->flag |= FA_MODIFIED | FA_RESIZED;
 			if (fs->free_clst <= fs->n_fatent - 2) {	/* Update FSINFO */
 				fs->free_clst -= tcl;
 				fs->fsi_flag |= 1;
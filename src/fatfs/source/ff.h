@@ -322,14 +322,20 @@ FRESULT f_write (FIL* fp, const void* buff, UINT btw, UINT* bw);    /* Write dat
 FRESULT f_lseek (FIL* fp, FSIZE_t ofs);                             /* Move file pointer of the file object */
 FRESULT f_truncate (FIL* fp);                                       /* Truncate the file */
 FRESULT f_sync (FIL* fp);                                           /* Flush cached data of the writing file */
+FRESULT f_sync_ex (FIL* fp, BYTE opt);                              /* Flush cached data of the writing file with option */
+FRESULT f_syncfs (const TCHAR* path);                               /* Flush the volume and the device cache */
 FRESULT f_opendir (DIR* dp, const TCHAR* path);                     /* Open a directory */
 FRESULT f_closedir (DIR* dp);                                       /* Close an open directory */
 FRESULT f_readdir (DIR* dp, FILINFO* fno);                          /* Read a directory item */
+FRESULT f_readdir_batch (DIR* dp, FILINFO* fno, UINT (*func)(const FILINFO*, void*), void* arg, UINT* nr); /* Read directory items in batch */
 FRESULT f_findfirst (DIR* dp, FILINFO* fno, const TCHAR* path, const TCHAR* pattern);   /* Find first file */
 FRESULT f_findnext (DIR* dp, FILINFO* fno);                         /* Find next file */
 FRESULT f_mkdir (const TCHAR* path);                                /* Create a sub directory */
 FRESULT f_unlink (const TCHAR* path);                               /* Delete an existing file or directory */
+FRESULT f_rmtree (const TCHAR* path);                               /* Delete a file or a directory tree */
+FRESULT f_compactdir (const TCHAR* path, UINT thr, void* work, UINT (*busy)(DWORD, LBA_t, void*), void* arg);     /* Reclaim deleted entries of a directory */
 FRESULT f_rename (const TCHAR* path_old, const TCHAR* path_new);    /* Rename/Move a file or directory */
+FRESULT f_rename_ex (const TCHAR* path_old, const TCHAR* path_new, BYTE opt, UINT (*busy)(LBA_t, const BYTE*, DWORD, void*), void* arg);   /* Rename/Move a file or directory with option */
 FRESULT f_stat (const TCHAR* path, FILINFO* fno);                   /* Get file status */
 FRESULT f_chmod (const TCHAR* path, BYTE attr, BYTE mask);          /* Change attribute of a file/dir */
 FRESULT f_utime (const TCHAR* path, const FILINFO* fno);            /* Change timestamp of a file/dir */
@@ -357,14 +363,21 @@ FRESULT f_write (FIL* fp, const void* buff, UINT btw, UINT* bw);	/* Write data t
 FRESULT f_lseek (FIL* fp, FSIZE_t ofs);								/* Move file pointer of the file object */
 FRESULT f_truncate (FIL* fp);										/* Truncate the file */
 FRESULT f_sync (FIL* fp);											/* Flush cached data of the writing file */
+FRESULT f_sync_ex (FIL* fp, BYTE opt);								/* Flush cached data of the writing file with option */
+FRESULT f_syncbuf (FIL* fp, BYTE reload);							/* Write back and reload the sector buffer of the file */
+FRESULT f_syncfs (FATFS *fs);										/* Flush the volume and the device cache */
 FRESULT f_opendir (FATFS *fs, DIR* dp, const TCHAR* path);			/* Open a directory */
 FRESULT f_closedir (DIR* dp);										/* Close an open directory */
 FRESULT f_readdir (DIR* dp, FILINFO* fno);							/* Read a directory item */
+FRESULT f_readdir_batch (DIR* dp, FILINFO* fno, UINT (*func)(const FILINFO*, void*), void* arg, UINT* nr);	/* Read directory items in batch */
 FRESULT f_findfirst (DIR* dp, FILINFO* fno, const TCHAR* path, const TCHAR* pattern);	/* Find first file */
 FRESULT f_findnext (DIR* dp, FILINFO* fno);							/* Find next file */
 FRESULT f_mkdir (FATFS *fs, const TCHAR* path);						/* Create a sub directory */
 FRESULT f_unlink (FATFS *fs, const TCHAR* path);					/* Delete an existing file or directory */
+FRESULT f_rmtree (FATFS *fs, const TCHAR* path);					/* Delete a file or a directory tree */
+FRESULT f_compactdir (FATFS *fs, const TCHAR* path, UINT thr, void* work, UINT (*busy)(DWORD, LBA_t, void*), void* arg);	/* Reclaim deleted entries of a directory */
 FRESULT f_rename (FATFS *fs, const TCHAR* path_old, const TCHAR* path_new);	/* Rename/Move a file or directory */
+FRESULT f_rename_ex (FATFS *fs, const TCHAR* path_old, const TCHAR* path_new, BYTE opt, UINT (*busy)(LBA_t, const BYTE*, DWORD, void*), void* arg);	/* Rename/Move a file or directory with option */
 FRESULT f_stat (FATFS *fs, const TCHAR* path, FILINFO* fno);		/* Get file status */
 FRESULT f_chmod (const TCHAR* path, BYTE attr, BYTE mask);          /* Change attribute of a file/dir */
 FRESULT f_utime (const TCHAR* path, const FILINFO* fno);	        /* Change timestamp of a file/dir */
@@ -430,6 +443,17 @@ int ff_cre_syncobj (BYTE vol, FF_SYNC_t* sobj);	/* Create a sync object */
 int ff_req_grant (FF_SYNC_t sobj);		/* Lock sync object */
 void ff_rel_grant (FF_SYNC_t sobj);		/* Unlock sync object */
 int ff_del_syncobj (FF_SYNC_t sobj);	/* Delete a sync object */
+#if FF_FS_RWLOCK
+int ff_req_grant_shared (FF_SYNC_t sobj);	/* Lock sync object in shared mode */
+void ff_rel_grant_shared (FF_SYNC_t sobj);	/* Unlock sync object from shared mode */
+void ff_req_window (FF_SYNC_t sobj);	/* Lock sector window among shared holders */
+void ff_rel_window (FF_SYNC_t sobj);	/* Unlock sector window */
+#endif
+#if FF_FS_XFER_UNLOCK
+void ff_rel_grant_xfer (FF_SYNC_t sobj, int shr);	/* Unlock sync object for a data transfer */
+int ff_req_grant_xfer (FF_SYNC_t sobj, int shr);	/* Lock sync object back after a data transfer */
+void ff_wait_xfer (FF_SYNC_t sobj);	/* Wait for data transfers out of the lock */
+#endif
 #endif
 
 
@@ -447,10 +471,20 @@ int ff_del_syncobj (FF_SYNC_t sobj);	/* Delete a sync object */
 #define	FA_CREATE_ALWAYS	0x08
 #define	FA_OPEN_ALWAYS		0x10
 #define	FA_OPEN_APPEND		0x30
+#ifdef __MS_RTOS__
+#define	FA_DIRECT			0x80	/* No sector buffer, sector aligned transfers only */
+#endif
 
 /* Fast seek controls (2nd argument of f_lseek) */
 #define CREATE_LINKMAP	((FSIZE_t)0 - 1)
 
+/* Rename options (4th argument of f_rename_ex) */
+#define RN_REPLACE	0x01
+
+/* Sync options (2nd argument of f_sync_ex) */
+#define SY_NOFLUSH	0x01
+#define SY_DATAONLY	0x02
+
 /* Format options (2nd argument of f_mkfs) */
 #define FM_FAT		0x01
 #define FM_FAT32	0x02
@@ -71,6 +71,20 @@
 /* This option switches f_forward() function. (0:Disable or 1:Enable) */
 
 
+#define FF_USE_READDIR_BATCH	0
+/* This option switches f_readdir_batch() function. (0:Disable or 1:Enable) */
+
+
+#define FF_USE_RMTREE	0
+/* This option switches f_rmtree() function. (0:Disable or 1:Enable)
+/  FF_FS_READONLY needs to be 0 and FF_FS_MINIMIZE needs to be 0 to enable this option. */
+
+
+#define FF_USE_COMPACTDIR	0
+/* This option switches f_compactdir() function. (0:Disable or 1:Enable)
+/  FF_FS_READONLY needs to be 0 and FF_FS_MINIMIZE needs to be 0 to enable this option. */
+
+
 /*---------------------------------------------------------------------------/
 / Locale and Namespace Configurations
 /---------------------------------------------------------------------------*/
@@ -104,6 +118,19 @@
 */
 
 
+#define FF_DBCS_DIRECT	0
+/* This option selects the conversion tables used by ff_uni2oem() and ff_oem2uni()
+/  for the DBCS code pages (932, 936, 949 and 950).
+/
+/   0: Sorted code pairs searched in binary. (up to 16 probes per character)
+/   1: Direct-indexed two-level tables. (one page lookup per character)
+/
+/  Size of the tables in ROM for each code page (pairs / direct):
+/  932: 58 KiB / 72 KiB, 936: 170 KiB / 115 KiB, 949: 133 KiB / 135 KiB,
+/  950: 106 KiB / 92 KiB. When FF_CODE_PAGE is not DBCS or 0, this option has
+/  no effect. */
+
+
 #define FF_USE_LFN		0
 #define FF_MAX_LFN		255
 /* The FF_USE_LFN switches the support for LFN (long file name).
@@ -124,6 +151,25 @@
 /  ff_memfree() exemplified in ffsystem.c, need to be added to the project. */
 
 
+#define FF_LFN_VOLBUF	0
+/* This option switches the LFN working buffer per volume at FF_USE_LFN == 3.
+/  (0:Allocate on every call or 1:Provided per volume)
+/  When enabled, path functions do not call ff_memalloc() and ff_memfree().
+/  Instead, FATFS.lfnbuf needs to point to a working buffer of the size
+/  described above before f_mount() is called, and it stays in use until the
+/  volume is unmounted. The buffer is only used under the volume grant. */
+
+
+#define FF_WTOUPPER_DIRECT	0
+/* This option selects the Unicode up-case conversion table used by ff_wtoupper().
+/
+/   0: Compressed table walked per character. (about 0.7 KiB of ROM)
+/   1: Direct-indexed two-level table. (about 7.3 KiB of ROM)
+/
+/  ASCII characters are converted without table in both cases.
+/  When LFN is not enabled, this option has no effect. */
+
+
 #define FF_LFN_UNICODE	0
 /* This option switches the character encoding on the API when LFN is enabled.
 /
@@ -223,6 +269,16 @@
 /  disk_ioctl() function. */
 
 
+#define FF_FS_SGIO		0
+/* This option sets the maximum number of segments in a vectored disk transfer.
+/  (0:Disable or 1-255)
+/  When enabled, f_read() and f_write() gather the whole sector transfers of a
+/  fragmented file into segment lists and the FAT mirror is written together with
+/  the 1st FAT, through disk_readv() and disk_writev() function, which must be
+/  added to the disk I/O layer. Each segment list takes 12 bytes per segment (16
+/  bytes at FF_LBA64 == 1) on the stack of f_read() and f_write(). */
+
+
 
 /*---------------------------------------------------------------------------/
 / System Configurations
@@ -235,6 +291,13 @@
 /  buffer in the filesystem object (FATFS) is used for the file data transfer. */
 
 
+#define FF_USE_MEMFUNC	0
+/* This option selects the memory functions used internally for sector buffer copy,
+/  fill and compare. (0:Built-in byte loops or 1:C library memcpy/memset/memcmp)
+/  The C library versions are usually word-at-a-time or hand optimized for the
+/  target. Set 0 if <string.h> is not available. */
+
+
 #define FF_FS_EXFAT		0
 /* This option switches support for exFAT filesystem. (0:Disable or 1:Enable)
 /  To enable exFAT, also LFN needs to be enabled. (FF_USE_LFN >= 1)
@@ -300,6 +363,29 @@
 /  SemaphoreHandle_t and etc. A header file for O/S definitions needs to be
 /  included somewhere in the scope of ff.h. */
 
+
+#define FF_FS_RWLOCK	0
+/* This option switches the shared volume grant. (0:Disable or 1:Enable)
+/  When enabled, f_read() holds the volume in shared mode so that reads of
+/  different files proceed in parallel, and any other function holds it in
+/  exclusive mode. Shared holders serialize only on the sector window, which is
+/  used to follow the FAT. Also user provided handlers, ff_req_grant_shared(),
+/  ff_rel_grant_shared(), ff_req_window() and ff_rel_window() function, must be
+/  added to the project. A file object must not be read by two tasks at a time.
+/  This option has no effect when FF_FS_REENTRANT == 0 and cannot be used with
+/  FF_FS_TINY == 1. */
+
+
+#define FF_FS_XFER_UNLOCK	0
+/* This option switches unlocked data transfer. (0:Disable or 1:Enable)
+/  When enabled, f_read() and f_write() release the volume grant while they
+/  transfer whole sectors between the device and the caller's buffer, and take
+/  it back for the FAT and directory updates. Freeing of clusters waits for such
+/  transfers to finish. Also user provided handlers, ff_rel_grant_xfer(),
+/  ff_req_grant_xfer() and ff_wait_xfer() function, must be added to the
+/  project. This option has no effect when FF_FS_REENTRANT == 0 and cannot be
+/  used with FF_FS_TINY == 1. */
+
 #endif /* __MS_RTOS__ */
 
 /*--- End of configuration options ---*/
@@ -17,14 +17,138 @@
 
 #undef DIR
 #include "fatfs/source/ff.h"
+#include "fatfs/source/diskio.h"
 
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
 
 /**
  * @brief FAT file system.
  */
 
+#if FF_USE_LFN == 3 && FF_LFN_VOLBUF
+#if FF_FS_EXFAT
+#define MS_FATFS_LFNBUF_SIZE    ((FF_MAX_LFN + 1U) * sizeof(WCHAR) + (FF_MAX_LFN + 44U) / 15U * 32U)
+#else
+#define MS_FATFS_LFNBUF_SIZE    ((FF_MAX_LFN + 1U) * sizeof(WCHAR))
+#endif
+#endif
+
+/*
+ * Kind of the object behind file->ctx, kind is the first member of each object
+ */
+#define MS_FATFS_OBJ_FILE       1U
+#define MS_FATFS_OBJ_DIR        2U
+
+#define MS_FATFS_OBJ_KIND(obj)  (*(ms_uint32_t *)(obj))
+
+/*
+ * Position in the changes of a file, both counts wrap around
+ */
+typedef struct {
+    ms_uint32_t             seq;            /* Writes and truncates */
+    ms_size_t               nbytes;         /* Bytes written */
+} __ms_fatfs_mark_t;
+
+/*
+ * File object
+ */
+typedef struct __ms_fatfs_file {
+    ms_uint32_t             kind;           /* MS_FATFS_OBJ_FILE */
+    FIL                     fil;
+    ms_handle_t             lock;           /* Serializes the calls on fil, tasks may share the file */
+    struct __ms_fatfs_file *prev;           /* Link on the open file list */
+    struct __ms_fatfs_file *next;
+#if MS_FATFS_AIO_WORKERS > 0
+    ms_fatfs_aiocb_t       *aio_head;       /* Pending requests, in submission order */
+    ms_fatfs_aiocb_t       *aio_tail;
+    struct __ms_fatfs_file *aio_next;       /* Link on the run queue */
+    ms_bool_t               aio_busy;       /* On the run queue or being served */
+    ms_bool_t               aio_draining;   /* Close is waiting on aio_drain */
+    ms_handle_t             aio_drain;      /* Posted when the file goes idle */
+#endif
+#if MS_FATFS_FLUSH_AGE > 0
+    ms_tick64_t             dirty_since;    /* Time of the first change not yet committed */
+    __ms_fatfs_mark_t       changed;        /* Changes made */
+    __ms_fatfs_mark_t       synced;         /* Changes covered by a successful commit */
+    __ms_fatfs_mark_t       staged;         /* Changes staged by the flusher, waiting for its commit */
+    ms_bool_t               flush_staged;
+#endif
+} __ms_fatfs_file_t;
+
+/*
+ * Directory object
+ */
+typedef struct __ms_fatfs_dir {
+    ms_uint32_t             kind;           /* MS_FATFS_OBJ_DIR */
+    DIR                     dir;
+    struct __ms_fatfs_dir  *prev;           /* Link on the open directory list */
+    struct __ms_fatfs_dir  *next;
+} __ms_fatfs_dir_t;
+
+/*
+ * Sector size of a mounted volume
+ */
+#if FF_MAX_SS != FF_MIN_SS
+#define MS_FATFS_SS(fs)         ((ms_size_t)(fs)->ssize)
+#else
+#define MS_FATFS_SS(fs)         ((ms_size_t)FF_MAX_SS)
+#endif
+
+/*
+ * A pooled file object holds the file object and its sector buffer in one cache line aligned block,
+ * the buffer is sized for the sector size of the volume at mount time.
+ * A file opened with O_DIRECT has no sector buffer, its object is allocated alone.
+ */
+#define MS_FATFS_FIL_SIZE       ((sizeof(__ms_fatfs_file_t) + MS_ARCH_CACHE_LINE_SIZE - 1U) & ~(MS_ARCH_CACHE_LINE_SIZE - 1U))
+#define MS_FATFS_FILE_OBJ_SIZE(ssize)   (MS_FATFS_FIL_SIZE + (ssize))
+
+/*
+ * Object pool, free objects are linked through their first word
+ */
+typedef struct {
+    ms_ptr_t                free_list;
+    ms_size_t               obj_size;
+    ms_fatfs_pool_stat_t    stat;
+} __ms_fatfs_pool_t;
+
+/*
+ * Mount context, fatfs must be the first member, mnt->ctx is also used as FATFS *
+ */
+typedef struct {
+    FATFS                   fatfs;
+    ms_handle_t             lock;           /* Protects the object pools, the queues and the counters below */
+    ms_handle_t             commit_lock;    /* Held by the task running a group commit */
+    ms_uint32_t             commit_started; /* Sequence number of the last group commit started */
+    ms_uint32_t             commit_done;    /* Sequence number of the last group commit done */
+    FRESULT                 commit_result;  /* Result of the last group commit done */
+    __ms_fatfs_pool_t       file_pool;
+    __ms_fatfs_pool_t       dir_pool;
+    ms_handle_t             files_lock;     /* Held with lock to change files, held alone by direct I/O syncing files */
+    __ms_fatfs_file_t      *files;          /* Open files */
+    __ms_fatfs_dir_t       *dirs;           /* Open directories */
+    ms_uint32_t             opening;        /* Opens between f_open() or f_opendir() and the link on their list */
+#if MS_FATFS_AIO_WORKERS > 0
+    ms_handle_t             aio_work;       /* Binary semaphore, posted when the run queue is not empty */
+    ms_handle_t             aio_done;       /* Binary semaphore, posted when the completion queue is not empty */
+    ms_handle_t             aio_exit;       /* Counting semaphore, posted by each exiting worker */
+    __ms_fatfs_file_t      *aio_runq_head;  /* Files with pending requests */
+    __ms_fatfs_file_t      *aio_runq_tail;
+    ms_fatfs_aiocb_t       *aio_done_head;  /* Completed requests without callback */
+    ms_fatfs_aiocb_t       *aio_done_tail;
+    ms_uint32_t             aio_nworkers;
+    ms_bool_t               aio_exit_req;
+#endif
+#if MS_FATFS_FLUSH_AGE > 0
+    ms_size_t               dirty_bytes;    /* Bytes written to the open files and not yet committed */
+    ms_handle_t             flush_kick;     /* Binary semaphore, wakes up the flusher */
+    ms_handle_t             flush_exit;     /* Binary semaphore, posted by the exiting flusher */
+    ms_bool_t               flush_started;
+    ms_bool_t               flush_exit_req;
+#endif
+} __ms_fatfs_mnt_t;
+
 static int __ms_fatfs_result_to_errno(FRESULT fresult)
 {
     int err;
@@ -153,35 +277,824 @@ static int __ms_oflag_to_fatfs_oflag(int oflag)
         ret |= FA_OPEN_APPEND;
     }
 
+    if (oflag & O_DIRECT) {
+        ret |= FA_DIRECT;
+    }
+
     return ret;
 }
 
+static time_t __ms_fatfs_fattime_to_time(WORD fdate, WORD ftime)
+{
+    struct tm tm;
+
+    bzero(&tm, sizeof(tm));
+
+    tm.tm_year  = ((fdate >> 9U) & 0x7fU) + 80;
+    tm.tm_mon   = ((fdate >> 5U) & 0x0fU) - 1;
+    tm.tm_mday  = fdate & 0x1fU;
+    tm.tm_hour  = (ftime >> 11U) & 0x1fU;
+    tm.tm_min   = (ftime >> 5U) & 0x3fU;
+    tm.tm_sec   = (ftime & 0x1fU) * 2U;
+    tm.tm_isdst = -1;
+
+    return mktime(&tm);
+}
+
+static void __ms_fatfs_finfo_to_stat(const FILINFO *finfo, ms_stat_t *buf)
+{
+    if (finfo->fattrib & AM_DIR) {
+        buf->st_mode = S_IFDIR;
+    } else {
+        buf->st_mode = S_IFREG;
+        buf->st_size = finfo->fsize;
+    }
+    if (finfo->fattrib & AM_RDO) {
+        buf->st_mode |= S_IRUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH;
+    } else {
+        buf->st_mode |= S_IRWXU | S_IRWXG | S_IRWXO;
+    }
+
+    if (finfo->fdate != 0U) {
+        buf->st_mtime = __ms_fatfs_fattime_to_time(finfo->fdate, finfo->ftime);
+        buf->st_atime = buf->st_mtime;
+        buf->st_ctime = buf->st_mtime;
+    }
+}
+
+static void __ms_fatfs_pool_init(__ms_fatfs_pool_t *pool, ms_size_t obj_size, ms_uint32_t low, ms_uint32_t high)
+{
+    ms_ptr_t obj;
+
+    pool->free_list = MS_NULL;
+    pool->obj_size  = obj_size;
+    bzero(&pool->stat, sizeof(pool->stat));
+    pool->stat.low  = low;
+    pool->stat.high = high;
+
+    /*
+     * Fill up to the low watermark, a short pool is not fatal
+     */
+    while (pool->stat.nfree < low) {
+        obj = ms_kmalloc_align(obj_size, MS_ARCH_CACHE_LINE_SIZE);
+        if (obj == MS_NULL) {
+            break;
+        }
+        *(ms_ptr_t *)obj = pool->free_list;
+        pool->free_list  = obj;
+        pool->stat.nfree++;
+    }
+}
+
+static void __ms_fatfs_pool_trim(__ms_fatfs_pool_t *pool, ms_uint32_t keep)
+{
+    ms_ptr_t obj;
+
+    while (pool->stat.nfree > keep) {
+        obj = pool->free_list;
+        pool->free_list = *(ms_ptr_t *)obj;
+        pool->stat.nfree--;
+        pool->stat.releases++;
+        (void)ms_kfree(obj);
+    }
+}
+
+static ms_ptr_t __ms_fatfs_pool_get(__ms_fatfs_mnt_t *ctx, __ms_fatfs_pool_t *pool)
+{
+    ms_ptr_t obj;
+
+    (void)ms_mutex_lock(ctx->lock, MS_TIMEOUT_FOREVER);
+
+    obj = pool->free_list;
+    if (obj != MS_NULL) {
+        pool->free_list = *(ms_ptr_t *)obj;
+        pool->stat.nfree--;
+        pool->stat.hits++;
+    } else {
+        obj = ms_kmalloc_align(pool->obj_size, MS_ARCH_CACHE_LINE_SIZE);
+        if (obj != MS_NULL) {
+            pool->stat.misses++;
+        }
+    }
+
+    if (obj != MS_NULL) {
+        pool->stat.ninuse++;
+        if (pool->stat.ninuse > pool->stat.peak) {
+            pool->stat.peak = pool->stat.ninuse;
+        }
+    }
+
+    (void)ms_mutex_unlock(ctx->lock);
+
+    return obj;
+}
+
+static void __ms_fatfs_pool_put(__ms_fatfs_mnt_t *ctx, __ms_fatfs_pool_t *pool, ms_ptr_t obj)
+{
+    (void)ms_mutex_lock(ctx->lock, MS_TIMEOUT_FOREVER);
+
+    pool->stat.ninuse--;
+    if (pool->stat.nfree < pool->stat.high) {
+        *(ms_ptr_t *)obj = pool->free_list;
+        pool->free_list  = obj;
+        pool->stat.nfree++;
+    } else {
+        pool->stat.releases++;
+        (void)ms_kfree(obj);
+    }
+
+    (void)ms_mutex_unlock(ctx->lock);
+}
+
+/*
+ * Group commit
+ *
+ * A task that has staged its file with f_sync_ex(SY_NOFLUSH) needs a volume flush
+ * started after that. Tasks arriving while a flush is in progress queue on
+ * commit_lock, and the first one to get it flushes for all of them, so concurrent
+ * syncs share one device cache flush. The queued discards are issued after it succeeds,
+ * a freed cluster is not trimmed before the FAT that frees it is on the disk.
+ */
+static FRESULT __ms_fatfs_commit(__ms_fatfs_mnt_t *ctx)
+{
+    ms_uint32_t target;
+    ms_uint32_t seq;
+    FRESULT fresult;
+
+    (void)ms_mutex_lock(ctx->lock, MS_TIMEOUT_FOREVER);
+    target = ctx->commit_started + 1U;
+    (void)ms_mutex_unlock(ctx->lock);
+
+    (void)ms_mutex_lock(ctx->commit_lock, MS_TIMEOUT_FOREVER);
+
+    (void)ms_mutex_lock(ctx->lock, MS_TIMEOUT_FOREVER);
+    if ((ms_int32_t)(ctx->commit_done - target) < 0) {
+        seq = ++ctx->commit_started;
+        (void)ms_mutex_unlock(ctx->lock);
+
+        fresult = f_syncfs(&ctx->fatfs);
+        if (fresult == FR_OK) {
+            (void)disk_discard(ctx->fatfs.pdrv);
+        }
+
+        (void)ms_mutex_lock(ctx->lock, MS_TIMEOUT_FOREVER);
+        ctx->commit_done   = seq;
+        ctx->commit_result = fresult;
+    } else {
+        fresult = ctx->commit_result;   /* Flushed by another task */
+    }
+    (void)ms_mutex_unlock(ctx->lock);
+
+    (void)ms_mutex_unlock(ctx->commit_lock);
+
+    return fresult;
+}
+
+/*
+ * Background write-back
+ *
+ * Open files are kept on a per mount list with the time they became dirty and the
+ * number of bytes written since. The flusher syncs the files dirty for longer than
+ * MS_FATFS_FLUSH_AGE, or all dirty files once MS_FATFS_FLUSH_BYTES are pending.
+ * It walks the list with files_lock held and skips a file whose lock is taken, the
+ * file is synced by a later pass. The files of a pass are staged in the sector window
+ * and committed together, and the queued discards go out with the commit. Each pass
+ * also issues the held writes.
+ *
+ * A sync takes a mark of the changes before staging the file, the file is clean up
+ * to that mark once the commit succeeds. Changes made after the mark, and the changes
+ * of a failed commit, keep the file dirty.
+ */
+
+/*
+ * Must be called with the file lock held
+ */
+static void __ms_fatfs_file_mark(__ms_fatfs_mnt_t *ctx, __ms_fatfs_file_t *fobj, __ms_fatfs_mark_t *mark)
+{
+#if MS_FATFS_FLUSH_AGE > 0
+    (void)ms_mutex_lock(ctx->lock, MS_TIMEOUT_FOREVER);
+    *mark = fobj->changed;
+    (void)ms_mutex_unlock(ctx->lock);
+#endif
+}
+
+/*
+ * The changes up to mark have been committed
+ */
+static void __ms_fatfs_file_clean(__ms_fatfs_mnt_t *ctx, __ms_fatfs_file_t *fobj, const __ms_fatfs_mark_t *mark)
+{
+#if MS_FATFS_FLUSH_AGE > 0
+    (void)ms_mutex_lock(ctx->lock, MS_TIMEOUT_FOREVER);
+    if ((ms_int32_t)(mark->seq - fobj->synced.seq) > 0) {
+        ctx->dirty_bytes -= mark->nbytes - fobj->synced.nbytes;
+        fobj->synced = *mark;
+    }
+    (void)ms_mutex_unlock(ctx->lock);
+#endif
+}
+
+#if MS_FATFS_FLUSH_AGE > 0
+static void __ms_fatfs_flusher(ms_ptr_t arg)
+{
+    __ms_fatfs_mnt_t *ctx = arg;
+    __ms_fatfs_file_t *fobj;
+    ms_tick64_t now;
+    ms_bool_t exit;
+    ms_bool_t all;
+    ms_bool_t due;
+    ms_uint32_t nstaged;
+    FRESULT fresult;
+
+    do {
+        (void)ms_semb_wait(ctx->flush_kick, (MS_FATFS_FLUSH_AGE + 1U) / 2U);
+
+        (void)ms_mutex_lock(ctx->files_lock, MS_TIMEOUT_FOREVER);
+        (void)ms_mutex_lock(ctx->lock, MS_TIMEOUT_FOREVER);
+        exit = ctx->flush_exit_req;
+        all  = ctx->dirty_bytes >= MS_FATFS_FLUSH_BYTES;
+        (void)ms_mutex_unlock(ctx->lock);
+        now  = ms_time_get();
+        nstaged = 0U;
+
+        for (fobj = ctx->files; (fobj != MS_NULL) && !exit; fobj = fobj->next) {
+            (void)ms_mutex_lock(ctx->lock, MS_TIMEOUT_FOREVER);
+            due = (fobj->changed.seq != fobj->synced.seq) &&
+                  (all || ((now - fobj->dirty_since) >= MS_FATFS_FLUSH_AGE));
+            (void)ms_mutex_unlock(ctx->lock);
+
+            if (due && (ms_mutex_lock(fobj->lock, MS_TIMEOUT_NO_WAIT) == MS_ERR_NONE)) {
+                __ms_fatfs_file_mark(ctx, fobj, &fobj->staged);
+                fresult = f_sync_ex(&fobj->fil, SY_NOFLUSH);
+                if (fresult == FR_OK) {
+                    fobj->flush_staged = MS_TRUE;
+                    nstaged++;
+                }
+                (void)ms_mutex_unlock(fobj->lock);
+            }
+        }
+        (void)ms_mutex_unlock(ctx->files_lock);
+
+        if (nstaged > 0U) {
+            fresult = __ms_fatfs_commit(ctx);
+
+            /*
+             * The files closed meanwhile have left the list, f_close() synced them
+             */
+            (void)ms_mutex_lock(ctx->files_lock, MS_TIMEOUT_FOREVER);
+            for (fobj = ctx->files; fobj != MS_NULL; fobj = fobj->next) {
+                if (fobj->flush_staged) {
+                    if (fresult == FR_OK) {
+                        __ms_fatfs_file_clean(ctx, fobj, &fobj->staged);
+                    }
+                    fobj->flush_staged = MS_FALSE;
+                }
+            }
+            (void)ms_mutex_unlock(ctx->files_lock);
+        } else {
+            (void)disk_unplug(ctx->fatfs.pdrv);
+        }
+    } while (!exit);
+
+    (void)ms_semb_post(ctx->flush_exit);
+}
+
+/*
+ * Must be called with ctx->lock held
+ */
+static void __ms_fatfs_flush_start(__ms_fatfs_mnt_t *ctx)
+{
+    if (ms_semb_create("fat_flk", MS_FALSE, MS_WAIT_TYPE_PRIO, &ctx->flush_kick) == MS_ERR_NONE) {
+        if (ms_semb_create("fat_flx", MS_FALSE, MS_WAIT_TYPE_PRIO, &ctx->flush_exit) == MS_ERR_NONE) {
+            if (ms_thread_create("t_fatfs_flush", __ms_fatfs_flusher, ctx,
+                                 MS_FATFS_FLUSH_STK_SIZE, MS_FATFS_FLUSH_PRIO, 0U,
+                                 MS_THREAD_OPT_SUPER | MS_THREAD_OPT_REENT_EN,
+                                 MS_NULL) == MS_ERR_NONE) {
+                ctx->flush_started = MS_TRUE;
+            } else {
+                (void)ms_semb_destroy(ctx->flush_exit);
+                (void)ms_semb_destroy(ctx->flush_kick);
+            }
+        } else {
+            (void)ms_semb_destroy(ctx->flush_kick);
+        }
+    }
+}
+
+static void __ms_fatfs_flush_stop(__ms_fatfs_mnt_t *ctx)
+{
+    if (ctx->flush_started) {
+        (void)ms_mutex_lock(ctx->lock, MS_TIMEOUT_FOREVER);
+        ctx->flush_exit_req = MS_TRUE;
+        (void)ms_mutex_unlock(ctx->lock);
+
+        (void)ms_semb_post(ctx->flush_kick);
+        (void)ms_semb_wait(ctx->flush_exit, MS_TIMEOUT_FOREVER);
+
+        (void)ms_semb_destroy(ctx->flush_exit);
+        (void)ms_semb_destroy(ctx->flush_kick);
+        ctx->flush_started  = MS_FALSE;
+        ctx->flush_exit_req = MS_FALSE;
+    }
+}
+#endif
+
+/*
+ * Account nbytes written to the file, the flusher is started on the first write
+ */
+static void __ms_fatfs_file_dirty(__ms_fatfs_mnt_t *ctx, __ms_fatfs_file_t *fobj, ms_size_t nbytes)
+{
+#if MS_FATFS_FLUSH_AGE > 0
+    (void)ms_mutex_lock(ctx->lock, MS_TIMEOUT_FOREVER);
+    if (!ctx->flush_started) {
+        __ms_fatfs_flush_start(ctx);
+    }
+
+    if (fobj->changed.seq == fobj->synced.seq) {
+        fobj->dirty_since = ms_time_get();
+    }
+    fobj->changed.seq++;
+    fobj->changed.nbytes += nbytes;
+    ctx->dirty_bytes     += nbytes;
+
+    if (ctx->flush_started && (ctx->dirty_bytes >= MS_FATFS_FLUSH_BYTES)) {
+        (void)ms_semb_post(ctx->flush_kick);
+    }
+    (void)ms_mutex_unlock(ctx->lock);
+#endif
+}
+
+/*
+ * Direct I/O
+ *
+ * A file opened with O_DIRECT has no sector buffer. Before each of its transfers the
+ * other open objects of the same file write back their dirty sector buffer, and after
+ * a write they reload it, with their file lock held. The open file list is walked
+ * with files_lock held, which keeps the other objects open but leaves lock free during
+ * the disk I/O. Only a file without a sector buffer takes files_lock with its own lock held.
+ * A transfer fails if a dirty buffer can not be written back before it. The sectors
+ * held below FatFs are kept coherent by the porting layer.
+ */
+
+static FRESULT __ms_fatfs_direct_sync(__ms_fatfs_mnt_t *ctx, __ms_fatfs_file_t *fobj, BYTE reload)
+{
+    __ms_fatfs_file_t *other;
+    FRESULT fresult = FR_OK;
+    FRESULT ret;
+
+    if (fobj->fil.buf == MS_NULL) {
+        (void)ms_mutex_lock(ctx->files_lock, MS_TIMEOUT_FOREVER);
+        for (other = ctx->files; other != MS_NULL; other = other->next) {
+            if ((other->fil.buf != MS_NULL) &&
+                (other->fil.dir_sect == fobj->fil.dir_sect) &&
+                (other->fil.dir_ptr == fobj->fil.dir_ptr)) {
+                (void)ms_mutex_lock(other->lock, MS_TIMEOUT_FOREVER);
+                ret = f_syncbuf(&other->fil, reload);
+                (void)ms_mutex_unlock(other->lock);
+                if ((ret != FR_OK) && (ret != FR_INVALID_OBJECT) && (fresult == FR_OK)) {
+                    fresult = ret;      /* Closed meanwhile is not an error, f_close() wrote it back */
+                }
+            }
+        }
+        (void)ms_mutex_unlock(ctx->files_lock);
+    }
+
+    return fresult;
+}
+
+static FRESULT __ms_fatfs_file_read(__ms_fatfs_mnt_t *ctx, __ms_fatfs_file_t *fobj, ms_ptr_t buf, ms_size_t len, UINT *rlen)
+{
+    FRESULT fresult;
+
+    fresult = __ms_fatfs_direct_sync(ctx, fobj, 0U);
+    if (fresult == FR_OK) {
+        fresult = f_read(&fobj->fil, buf, len, rlen);
+    } else {
+        *rlen = 0U;
+    }
+
+    return fresult;
+}
+
+static FRESULT __ms_fatfs_file_write(__ms_fatfs_mnt_t *ctx, __ms_fatfs_file_t *fobj, ms_const_ptr_t buf, ms_size_t len, UINT *wlen)
+{
+    FRESULT fresult;
+
+    fresult = __ms_fatfs_direct_sync(ctx, fobj, 0U);
+    if (fresult == FR_OK) {
+        fresult = f_write(&fobj->fil, buf, len, wlen);
+        if (*wlen > 0U) {
+            (void)__ms_fatfs_direct_sync(ctx, fobj, 1U);    /* A buffer that fails to reload is failed by f_syncbuf() */
+        }
+    } else {
+        *wlen = 0U;
+    }
+
+    return fresult;
+}
+
+#if MS_FATFS_AIO_WORKERS > 0
+/*
+ * Asynchronous I/O
+ *
+ * A file with pending requests is queued once on the run queue. A worker takes the
+ * file, serves its oldest request and puts the file back at the tail if more are
+ * pending, so the requests of a file complete in submission order and different
+ * files are served in parallel.
+ */
+
+static void __ms_fatfs_aio_serve(__ms_fatfs_mnt_t *ctx, __ms_fatfs_file_t *fobj, ms_fatfs_aiocb_t *aiocb)
+{
+    FIL *fatfs_file = &fobj->fil;
+    FRESULT fresult = FR_OK;
+    UINT len = 0U;
+
+    (void)ms_mutex_lock(fobj->lock, MS_TIMEOUT_FOREVER);
+
+    if (aiocb->offset >= 0) {
+        fresult = f_lseek(fatfs_file, aiocb->offset);
+    }
+
+    if (fresult == FR_OK) {
+        if (aiocb->opcode == MS_FATFS_AIO_READ) {
+            fresult = __ms_fatfs_file_read(ctx, fobj, aiocb->buf, aiocb->len, &len);
+        } else {
+            fresult = __ms_fatfs_file_write(ctx, fobj, aiocb->buf, aiocb->len, &len);
+        }
+    }
+
+
+    if ((aiocb->opcode == MS_FATFS_AIO_WRITE) && (len > 0U)) {
+        __ms_fatfs_file_dirty(ctx, fobj, len);
+    }
+    (void)ms_mutex_unlock(fobj->lock);
+
+    if ((fresult != FR_OK) && (len == 0U)) {
+        aiocb->error  = __ms_fatfs_result_to_errno(fresult);
+        aiocb->result = -1;
+    } else {
+        aiocb->error  = 0;
+        aiocb->result = len;
+    }
+}
+
+static void __ms_fatfs_aio_complete(__ms_fatfs_mnt_t *ctx, ms_fatfs_aiocb_t *aiocb)
+{
+    if (aiocb->callback != MS_NULL) {
+        aiocb->callback(aiocb);
+
+    } else {
+        aiocb->next = MS_NULL;
+
+        (void)ms_mutex_lock(ctx->lock, MS_TIMEOUT_FOREVER);
+        if (ctx->aio_done_tail != MS_NULL) {
+            ctx->aio_done_tail->next = aiocb;
+        } else {
+            ctx->aio_done_head = aiocb;
+        }
+        ctx->aio_done_tail = aiocb;
+        (void)ms_mutex_unlock(ctx->lock);
+
+        (void)ms_semb_post(ctx->aio_done);
+    }
+}
+
+/*
+ * Must be called with ctx->lock held
+ */
+static void __ms_fatfs_aio_runq_put(__ms_fatfs_mnt_t *ctx, __ms_fatfs_file_t *fobj)
+{
+    fobj->aio_next = MS_NULL;
+    if (ctx->aio_runq_tail != MS_NULL) {
+        ctx->aio_runq_tail->aio_next = fobj;
+    } else {
+        ctx->aio_runq_head = fobj;
+    }
+    ctx->aio_runq_tail = fobj;
+
+    (void)ms_semb_post(ctx->aio_work);
+}
+
+static void __ms_fatfs_aio_worker(ms_ptr_t arg)
+{
+    __ms_fatfs_mnt_t *ctx = arg;
+    __ms_fatfs_file_t *fobj;
+    ms_fatfs_aiocb_t *aiocb = MS_NULL;
+    ms_bool_t exit;
+
+    do {
+        (void)ms_mutex_lock(ctx->lock, MS_TIMEOUT_FOREVER);
+        fobj = ctx->aio_runq_head;
+        if (fobj != MS_NULL) {
+            ctx->aio_runq_head = fobj->aio_next;
+            if (ctx->aio_runq_head == MS_NULL) {
+                ctx->aio_runq_tail = MS_NULL;
+            } else {
+                (void)ms_semb_post(ctx->aio_work);  /* Wake up another worker for the rest */
+            }
+
+            aiocb = fobj->aio_head;
+            fobj->aio_head = aiocb->next;
+            if (fobj->aio_head == MS_NULL) {
+                fobj->aio_tail = MS_NULL;
+            }
+        }
+        exit = (fobj == MS_NULL) && ctx->aio_exit_req;
+        (void)ms_mutex_unlock(ctx->lock);
+
+        if (fobj != MS_NULL) {
+            __ms_fatfs_aio_serve(ctx, fobj, aiocb);
+
+            /*
+             * Complete before the file can go to another worker, to keep the order
+             */
+            __ms_fatfs_aio_complete(ctx, aiocb);
+
+            (void)ms_mutex_lock(ctx->lock, MS_TIMEOUT_FOREVER);
+            if (fobj->aio_head != MS_NULL) {
+                __ms_fatfs_aio_runq_put(ctx, fobj);
+            } else {
+                fobj->aio_busy = MS_FALSE;
+                if (fobj->aio_draining) {
+                    (void)ms_semb_post(fobj->aio_drain);
+                }
+            }
+            (void)ms_mutex_unlock(ctx->lock);
+
+        } else if (!exit) {
+            (void)ms_semb_wait(ctx->aio_work, MS_TIMEOUT_FOREVER);
+        }
+    } while (!exit);
+
+    (void)ms_semb_post(ctx->aio_work);  /* Wake up the next worker to exit */
+    (void)ms_semc_post(ctx->aio_exit);
+}
+
+/*
+ * Must be called with ctx->lock held
+ */
+static int __ms_fatfs_aio_start(__ms_fatfs_mnt_t *ctx)
+{
+    int ret = 0;
+
+    if (ctx->aio_nworkers == 0U) {
+        if (ms_semb_create("fat_aiow", MS_FALSE, MS_WAIT_TYPE_PRIO, &ctx->aio_work) == MS_ERR_NONE) {
+            if (ms_semb_create("fat_aiod", MS_FALSE, MS_WAIT_TYPE_PRIO, &ctx->aio_done) == MS_ERR_NONE) {
+                if (ms_semc_create("fat_aiox", 0U, MS_FATFS_AIO_WORKERS, MS_WAIT_TYPE_PRIO, &ctx->aio_exit) == MS_ERR_NONE) {
+                    while (ctx->aio_nworkers < MS_FATFS_AIO_WORKERS) {
+                        if (ms_thread_create("t_fatfs_aio", __ms_fatfs_aio_worker, ctx,
+                                             MS_FATFS_AIO_STK_SIZE, MS_FATFS_AIO_PRIO, 0U,
+                                             MS_THREAD_OPT_SUPER | MS_THREAD_OPT_REENT_EN,
+                                             MS_NULL) != MS_ERR_NONE) {
+                            break;
+                        }
+                        ctx->aio_nworkers++;
+                    }
+
+                    if (ctx->aio_nworkers == 0U) {
+                        (void)ms_semc_destroy(ctx->aio_exit);
+                        (void)ms_semb_destroy(ctx->aio_done);
+                        (void)ms_semb_destroy(ctx->aio_work);
+                        ret = -1;
+                    }
+                } else {
+                    (void)ms_semb_destroy(ctx->aio_done);
+                    (void)ms_semb_destroy(ctx->aio_work);
+                    ret = -1;
+                }
+            } else {
+                (void)ms_semb_destroy(ctx->aio_work);
+                ret = -1;
+            }
+        } else {
+            ret = -1;
+        }
+
+        if (ret < 0) {
+            ms_thread_set_errno(EAGAIN);
+        }
+    }
+
+    return ret;
+}
+
+static void __ms_fatfs_aio_stop(__ms_fatfs_mnt_t *ctx)
+{
+    ms_uint32_t i;
+
+    if (ctx->aio_nworkers > 0U) {
+        (void)ms_mutex_lock(ctx->lock, MS_TIMEOUT_FOREVER);
+        ctx->aio_exit_req = MS_TRUE;
+        (void)ms_mutex_unlock(ctx->lock);
+
+        (void)ms_semb_post(ctx->aio_work);
+        for (i = 0U; i < ctx->aio_nworkers; i++) {
+            (void)ms_semc_wait(ctx->aio_exit, MS_TIMEOUT_FOREVER);
+        }
+
+        (void)ms_semc_destroy(ctx->aio_exit);
+        (void)ms_semb_destroy(ctx->aio_done);
+        (void)ms_semb_destroy(ctx->aio_work);
+        ctx->aio_nworkers = 0U;
+        ctx->aio_exit_req = MS_FALSE;
+    }
+}
+
+/*
+ * Wait for the requests on the file to complete
+ */
+static void __ms_fatfs_aio_drain(__ms_fatfs_mnt_t *ctx, __ms_fatfs_file_t *fobj)
+{
+    ms_handle_t drain;
+
+    (void)ms_mutex_lock(ctx->lock, MS_TIMEOUT_FOREVER);
+    while (fobj->aio_busy) {
+        if (ms_semb_create("fat_aiodr", MS_FALSE, MS_WAIT_TYPE_PRIO, &drain) == MS_ERR_NONE) {
+            fobj->aio_drain    = drain;
+            fobj->aio_draining = MS_TRUE;
+            (void)ms_mutex_unlock(ctx->lock);
+            (void)ms_semb_wait(drain, MS_TIMEOUT_FOREVER);
+            (void)ms_mutex_lock(ctx->lock, MS_TIMEOUT_FOREVER);
+            fobj->aio_draining = MS_FALSE;
+            (void)ms_semb_destroy(drain);
+        } else {
+            (void)ms_mutex_unlock(ctx->lock);
+            (void)ms_thread_sleep(1U);
+            (void)ms_mutex_lock(ctx->lock, MS_TIMEOUT_FOREVER);
+        }
+    }
+    (void)ms_mutex_unlock(ctx->lock);
+}
+
+static int __ms_fatfs_aio_submit(ms_io_mnt_t *mnt, ms_io_file_t *file, ms_fatfs_aiocb_t *aiocb)
+{
+    __ms_fatfs_mnt_t *ctx = mnt->ctx;
+    __ms_fatfs_file_t *fobj = file->ctx;
+    int ret;
+
+    if (fobj->kind != MS_FATFS_OBJ_FILE) {
+        ms_thread_set_errno(EBADF);
+        ret = -1;
+
+    } else if ((aiocb == MS_NULL) ||
+               ((aiocb->opcode != MS_FATFS_AIO_READ) && (aiocb->opcode != MS_FATFS_AIO_WRITE))) {
+        ms_thread_set_errno(EINVAL);
+        ret = -1;
+
+    } else {
+        (void)ms_mutex_lock(ctx->lock, MS_TIMEOUT_FOREVER);
+        ret = __ms_fatfs_aio_start(ctx);
+        if (ret == 0) {
+            aiocb->next   = MS_NULL;
+            aiocb->result = -1;
+            aiocb->error  = EINPROGRESS;
+
+            if (fobj->aio_tail != MS_NULL) {
+                fobj->aio_tail->next = aiocb;
+            } else {
+                fobj->aio_head = aiocb;
+            }
+            fobj->aio_tail = aiocb;
+
+            if (!fobj->aio_busy) {
+                fobj->aio_busy = MS_TRUE;
+                __ms_fatfs_aio_runq_put(ctx, fobj);
+            }
+        }
+        (void)ms_mutex_unlock(ctx->lock);
+    }
+
+    return ret;
+}
+
+static int __ms_fatfs_aio_reap(ms_io_mnt_t *mnt, ms_fatfs_aioreap_t *param)
+{
+    __ms_fatfs_mnt_t *ctx = mnt->ctx;
+    ms_fatfs_aiocb_t *aiocb;
+    int ret;
+
+    if ((param == MS_NULL) || (param->list == MS_NULL) || (param->nr == 0U)) {
+        ms_thread_set_errno(EINVAL);
+        ret = -1;
+
+    } else {
+        param->nreaped = 0U;
+
+        (void)ms_mutex_lock(ctx->lock, MS_TIMEOUT_FOREVER);
+        ret = __ms_fatfs_aio_start(ctx);
+        while ((ret == 0) && (ctx->aio_done_head == MS_NULL)) {
+            (void)ms_mutex_unlock(ctx->lock);
+            if (ms_semb_wait(ctx->aio_done, param->timeout) != MS_ERR_NONE) {
+                ms_thread_set_errno(ETIMEDOUT);
+                ret = -1;
+            }
+            (void)ms_mutex_lock(ctx->lock, MS_TIMEOUT_FOREVER);
+        }
+
+        if (ret == 0) {
+            while ((ctx->aio_done_head != MS_NULL) && (param->nreaped < param->nr)) {
+                aiocb = ctx->aio_done_head;
+                ctx->aio_done_head = aiocb->next;
+                param->list[param->nreaped++] = aiocb;
+            }
+
+            if (ctx->aio_done_head == MS_NULL) {
+                ctx->aio_done_tail = MS_NULL;
+            } else {
+                (void)ms_semb_post(ctx->aio_done);  /* Wake up another reaper for the rest */
+            }
+        }
+        (void)ms_mutex_unlock(ctx->lock);
+    }
+
+    return ret;
+}
+#endif
+
+static int __ms_fatfs_ctx_init(__ms_fatfs_mnt_t *ctx)
+{
+    int ret;
+
+    if (ms_mutex_create("fat_mnt", MS_WAIT_TYPE_PRIO, &ctx->lock) == MS_ERR_NONE) {
+        if (ms_mutex_create("fat_commit", MS_WAIT_TYPE_PRIO, &ctx->commit_lock) == MS_ERR_NONE) {
+            if (ms_mutex_create("fat_files", MS_WAIT_TYPE_PRIO, &ctx->files_lock) == MS_ERR_NONE) {
+                ret = 0;
+            } else {
+                (void)ms_mutex_destroy(ctx->commit_lock);
+                (void)ms_mutex_destroy(ctx->lock);
+                ret = -1;
+            }
+        } else {
+            (void)ms_mutex_destroy(ctx->lock);
+            ret = -1;
+        }
+    } else {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+static void __ms_fatfs_ctx_deinit(__ms_fatfs_mnt_t *ctx)
+{
+    (void)ms_mutex_destroy(ctx->files_lock);
+    (void)ms_mutex_destroy(ctx->commit_lock);
+    (void)ms_mutex_destroy(ctx->lock);
+}
+
 static int __ms_fatfs_mount(ms_io_mnt_t *mnt, ms_io_device_t *dev, const char *dev_name, ms_const_ptr_t param)
 {
+    __ms_fatfs_mnt_t *ctx;
     FATFS *fatfs;
     FRESULT fresult;
     int ret;
 
     if (dev != MS_NULL) {
-        fatfs = ms_kzalloc(sizeof(FATFS));
-        if (fatfs != MS_NULL) {
-            fatfs->pdrv  = dev;
+        ctx = ms_kzalloc(sizeof(__ms_fatfs_mnt_t));
+        if (ctx != MS_NULL) {
+            fatfs = &ctx->fatfs;
+            fatfs->pdrv  = disk_attach(dev);
             fatfs->ipart = (BYTE)(((ms_addr_t)param) & 0xffUL);
 
             fatfs->win = ms_kmalloc_align(FF_MAX_SS, MS_ARCH_CACHE_LINE_SIZE);
-            if (fatfs->win != MS_NULL) {
+#if FF_USE_LFN == 3 && FF_LFN_VOLBUF
+            fatfs->lfnbuf = ms_kmalloc(MS_FATFS_LFNBUF_SIZE);
+            if ((fatfs->pdrv != MS_NULL) && (fatfs->win != MS_NULL) && (fatfs->lfnbuf != MS_NULL) &&
+#else
+            if ((fatfs->pdrv != MS_NULL) && (fatfs->win != MS_NULL) &&
+#endif
+                (__ms_fatfs_ctx_init(ctx) == 0)) {
                 fresult = f_mount(fatfs, "/", 1U);
                 if (fresult != FR_OK) {
+                    __ms_fatfs_ctx_deinit(ctx);
+#if FF_USE_LFN == 3 && FF_LFN_VOLBUF
+                    (void)ms_kfree(fatfs->lfnbuf);
+#endif
                     (void)ms_kfree(fatfs->win);
-                    (void)ms_kfree(fatfs);
+                    disk_detach(fatfs->pdrv);
+                    (void)ms_kfree(ctx);
                     ms_thread_set_errno(__ms_fatfs_result_to_errno(fresult));
                     ret = -1;
                 } else {
-                    mnt->ctx = fatfs;
+                    __ms_fatfs_pool_init(&ctx->file_pool, MS_FATFS_FILE_OBJ_SIZE(MS_FATFS_SS(fatfs)),
+                                         MS_FATFS_FILE_POOL_LOW, MS_FATFS_FILE_POOL_HIGH);
+                    __ms_fatfs_pool_init(&ctx->dir_pool, sizeof(__ms_fatfs_dir_t),
+                                         MS_FATFS_DIR_POOL_LOW, MS_FATFS_DIR_POOL_HIGH);
+                    mnt->ctx = ctx;
                     ret = 0;
                 }
             } else {
-                (void)ms_kfree(fatfs);
+#if FF_USE_LFN == 3 && FF_LFN_VOLBUF
+                if (fatfs->lfnbuf != MS_NULL) {
+                    (void)ms_kfree(fatfs->lfnbuf);
+                }
+#endif
+                if (fatfs->win != MS_NULL) {
+                    (void)ms_kfree(fatfs->win);
+                }
+                if (fatfs->pdrv != MS_NULL) {
+                    disk_detach(fatfs->pdrv);
+                }
+                (void)ms_kfree(ctx);
                 ms_thread_set_errno(ENOMEM);
                 ret = -1;
             }
@@ -200,16 +1113,24 @@ static int __ms_fatfs_mount(ms_io_mnt_t *mnt, ms_io_device_t *dev, const char *d
 static int __ms_fatfs_mkfs(ms_io_mnt_t *mnt, ms_const_ptr_t param)
 {
     FATFS *fatfs = mnt->ctx;
-    BYTE work[FF_MAX_SS];
+    ms_ptr_t work;
     FRESULT fresult;
     int ret;
 
-    fresult = f_mkfs(fatfs, "", MS_NULL, work, sizeof(work));
-    if (fresult != FR_OK) {
-        ms_thread_set_errno(__ms_fatfs_result_to_errno(fresult));
-        ret = -1;
+    work = ms_kmalloc(FF_MAX_SS);
+    if (work != MS_NULL) {
+        fresult = f_mkfs(fatfs, "", MS_NULL, work, FF_MAX_SS);
+        (void)ms_kfree(work);
+        if (fresult != FR_OK) {
+            ms_thread_set_errno(__ms_fatfs_result_to_errno(fresult));
+            ret = -1;
+        } else {
+            (void)disk_discard(fatfs->pdrv);
+            ret = 0;
+        }
     } else {
-        ret = 0;
+        ms_thread_set_errno(ENOMEM);
+        ret = -1;
     }
 
     return ret;
@@ -217,50 +1138,122 @@ static int __ms_fatfs_mkfs(ms_io_mnt_t *mnt, ms_const_ptr_t param)
 
 static int __ms_fatfs_unmount(ms_io_mnt_t *mnt, ms_const_ptr_t param)
 {
-    FATFS *fatfs = mnt->ctx;
+    __ms_fatfs_mnt_t *ctx = mnt->ctx;
+    FATFS *fatfs = &ctx->fatfs;
     FRESULT fresult;
     int ret;
 
+    /*
+     * The workers and the flusher use the volume, stop them before its sync object goes,
+     * they are started again on demand if the unmount fails
+     */
+#if MS_FATFS_AIO_WORKERS > 0
+    __ms_fatfs_aio_stop(ctx);
+#endif
+#if MS_FATFS_FLUSH_AGE > 0
+    __ms_fatfs_flush_stop(ctx);
+#endif
+
     fresult = f_unmount(fatfs);
     if ((fresult != FR_OK) && !mnt->umount_req) {
         ms_thread_set_errno(__ms_fatfs_result_to_errno(fresult));
         ret = -1;
     } else {
         mnt->ctx = MS_NULL;
+        __ms_fatfs_pool_trim(&ctx->file_pool, 0U);
+        __ms_fatfs_pool_trim(&ctx->dir_pool, 0U);
+        __ms_fatfs_ctx_deinit(ctx);
+#if FF_USE_LFN == 3 && FF_LFN_VOLBUF
+        (void)ms_kfree(fatfs->lfnbuf);
+#endif
         (void)ms_kfree(fatfs->win);
-        (void)ms_kfree(fatfs);
+        disk_detach(fatfs->pdrv);
+        (void)ms_kfree(ctx);
         ret = 0;
     }
 
     return ret;
 }
 
+static __ms_fatfs_file_t *__ms_fatfs_file_alloc(__ms_fatfs_mnt_t *ctx, int fatfs_oflag)
+{
+    __ms_fatfs_file_t *fobj;
+
+    if (fatfs_oflag & FA_DIRECT) {
+        fobj = ms_kmalloc_align(MS_FATFS_FIL_SIZE, MS_ARCH_CACHE_LINE_SIZE);
+        if (fobj != MS_NULL) {
+            bzero(fobj, sizeof(__ms_fatfs_file_t));
+        }
+    } else {
+        fobj = __ms_fatfs_pool_get(ctx, &ctx->file_pool);
+        if (fobj != MS_NULL) {
+            bzero(fobj, sizeof(__ms_fatfs_file_t));
+            fobj->fil.buf = (BYTE *)fobj + MS_FATFS_FIL_SIZE;
+        }
+    }
+
+    if (fobj != MS_NULL) {
+        fobj->kind = MS_FATFS_OBJ_FILE;
+        if (ms_mutex_create("fat_fil", MS_WAIT_TYPE_PRIO, &fobj->lock) != MS_ERR_NONE) {
+            if (fobj->fil.buf == MS_NULL) {
+                (void)ms_kfree(fobj);
+            } else {
+                __ms_fatfs_pool_put(ctx, &ctx->file_pool, fobj);
+            }
+            fobj = MS_NULL;
+        }
+    }
+
+    return fobj;
+}
+
+static void __ms_fatfs_file_free(__ms_fatfs_mnt_t *ctx, __ms_fatfs_file_t *fobj)
+{
+    (void)ms_mutex_destroy(fobj->lock);
+
+    if (fobj->fil.buf == MS_NULL) {
+        (void)ms_kfree(fobj);
+    } else {
+        __ms_fatfs_pool_put(ctx, &ctx->file_pool, fobj);
+    }
+}
+
 static int __ms_fatfs_open(ms_io_mnt_t *mnt, ms_io_file_t *file, const char *path, int oflag, ms_mode_t mode)
 {
-    FATFS *fatfs = mnt->ctx;
-    FIL *fatfs_file;
+    __ms_fatfs_mnt_t *ctx = mnt->ctx;
+    __ms_fatfs_file_t *fobj;
     FRESULT fresult;
     int ret;
 
-    fatfs_file = ms_kzalloc(sizeof(FIL));
-    if (fatfs_file != MS_NULL) {
-        fatfs_file->buf = ms_kmalloc_align(FF_MAX_SS, MS_ARCH_CACHE_LINE_SIZE);
-        if (fatfs_file->buf != MS_NULL) {
-            oflag = __ms_oflag_to_fatfs_oflag(oflag);
-            fresult = f_open(fatfs, fatfs_file, path, oflag);
-            if (fresult != FR_OK) {
-                (void)ms_kfree(fatfs_file->buf);
-                (void)ms_kfree(fatfs_file);
-                ms_thread_set_errno(__ms_fatfs_result_to_errno(fresult));
-                ret = -1;
-            } else {
-                file->ctx = fatfs_file;
-                ret = 0;
+    oflag = __ms_oflag_to_fatfs_oflag(oflag);
+    fobj = __ms_fatfs_file_alloc(ctx, oflag);
+    if (fobj != MS_NULL) {
+        (void)ms_mutex_lock(ctx->lock, MS_TIMEOUT_FOREVER);
+        ctx->opening++;
+        (void)ms_mutex_unlock(ctx->lock);
+
+        fresult = f_open(&ctx->fatfs, &fobj->fil, path, oflag);
+
+        (void)ms_mutex_lock(ctx->files_lock, MS_TIMEOUT_FOREVER);
+        (void)ms_mutex_lock(ctx->lock, MS_TIMEOUT_FOREVER);
+        ctx->opening--;
+        if (fresult == FR_OK) {
+            fobj->next = ctx->files;
+            if (ctx->files != MS_NULL) {
+                ctx->files->prev = fobj;
             }
-        } else {
-            (void)ms_kfree(fatfs_file);
-            ms_thread_set_errno(ENOMEM);
+            ctx->files = fobj;
+        }
+        (void)ms_mutex_unlock(ctx->lock);
+        (void)ms_mutex_unlock(ctx->files_lock);
+
+        if (fresult != FR_OK) {
+            __ms_fatfs_file_free(ctx, fobj);
+            ms_thread_set_errno(__ms_fatfs_result_to_errno(fresult));
             ret = -1;
+        } else {
+            file->ctx = fobj;
+            ret = 0;
         }
     } else {
         ms_thread_set_errno(ENOMEM);
@@ -272,17 +1265,42 @@ static int __ms_fatfs_open(ms_io_mnt_t *mnt, ms_io_file_t *file, const char *pat
 
 static int __ms_fatfs_close(ms_io_mnt_t *mnt, ms_io_file_t *file)
 {
-    FIL *fatfs_file = file->ctx;
+    __ms_fatfs_mnt_t *ctx = mnt->ctx;
+    __ms_fatfs_file_t *fobj = file->ctx;
     FRESULT fresult;
     int ret;
 
-    fresult = f_close(fatfs_file);
+#if MS_FATFS_AIO_WORKERS > 0
+    __ms_fatfs_aio_drain(ctx, fobj);
+#endif
+
+    /*
+     * Release the file lock before files_lock, direct I/O takes them in the other order
+     */
+    (void)ms_mutex_lock(fobj->lock, MS_TIMEOUT_FOREVER);
+    fresult = f_close(&fobj->fil);
+    (void)ms_mutex_unlock(fobj->lock);
     if ((fresult != FR_OK) && !mnt->umount_req) {
         ms_thread_set_errno(__ms_fatfs_result_to_errno(fresult));
         ret = -1;
     } else {
-        (void)ms_kfree(fatfs_file->buf);
-        (void)ms_kfree(fatfs_file);
+        (void)ms_mutex_lock(ctx->files_lock, MS_TIMEOUT_FOREVER);
+        (void)ms_mutex_lock(ctx->lock, MS_TIMEOUT_FOREVER);
+        if (fobj->prev != MS_NULL) {
+            fobj->prev->next = fobj->next;
+        } else {
+            ctx->files = fobj->next;
+        }
+        if (fobj->next != MS_NULL) {
+            fobj->next->prev = fobj->prev;
+        }
+#if MS_FATFS_FLUSH_AGE > 0
+        ctx->dirty_bytes -= fobj->changed.nbytes - fobj->synced.nbytes;
+#endif
+        (void)ms_mutex_unlock(ctx->lock);
+        (void)ms_mutex_unlock(ctx->files_lock);
+
+        __ms_fatfs_file_free(ctx, fobj);
         file->ctx = MS_NULL;
         ret = 0;
     }
@@ -292,17 +1310,19 @@ static int __ms_fatfs_close(ms_io_mnt_t *mnt, ms_io_file_t *file)
 
 static ms_ssize_t __ms_fatfs_read(ms_io_mnt_t *mnt, ms_io_file_t *file, ms_ptr_t buf, ms_size_t len)
 {
-    FIL *fatfs_file = file->ctx;
+    __ms_fatfs_file_t *fobj = file->ctx;
     FRESULT fresult;
     ms_ssize_t ret;
     UINT rlen;
 
-    fresult = f_read(fatfs_file, buf, len, &rlen);
-    if (fresult != FR_OK) {
+    (void)ms_mutex_lock(fobj->lock, MS_TIMEOUT_FOREVER);
+    fresult = __ms_fatfs_file_read(mnt->ctx, fobj, buf, len, &rlen);
+    (void)ms_mutex_unlock(fobj->lock);
+    if ((fresult != FR_OK) && (rlen == 0U)) {
         ms_thread_set_errno(__ms_fatfs_result_to_errno(fresult));
         ret = -1;
     } else {
-        ret = rlen;
+        ret = rlen;                     /* Short count if it failed after some bytes */
     }
 
     return ret;
@@ -310,17 +1330,22 @@ static ms_ssize_t __ms_fatfs_read(ms_io_mnt_t *mnt, ms_io_file_t *file, ms_ptr_t
 
 static ms_ssize_t __ms_fatfs_write(ms_io_mnt_t *mnt, ms_io_file_t *file, ms_const_ptr_t buf, ms_size_t len)
 {
-    FIL *fatfs_file = file->ctx;
+    __ms_fatfs_file_t *fobj = file->ctx;
     FRESULT fresult;
     ms_ssize_t ret;
     UINT wlen;
 
-    fresult = f_write(fatfs_file, buf, len, &wlen);
-    if (fresult != FR_OK) {
+    (void)ms_mutex_lock(fobj->lock, MS_TIMEOUT_FOREVER);
+    fresult = __ms_fatfs_file_write(mnt->ctx, fobj, buf, len, &wlen);
+    if (wlen > 0U) {
+        __ms_fatfs_file_dirty(mnt->ctx, fobj, wlen);
+    }
+    (void)ms_mutex_unlock(fobj->lock);
+    if ((fresult != FR_OK) && (wlen == 0U)) {
         ms_thread_set_errno(__ms_fatfs_result_to_errno(fresult));
         ret = -1;
     } else {
-        ret = wlen;
+        ret = wlen;                     /* Short count if it failed after some bytes */
     }
 
     return ret;
@@ -356,11 +1381,13 @@ static int __ms_fatfs_fcntl(ms_io_mnt_t *mnt, ms_io_file_t *file, int cmd, int a
 
 static int __ms_fatfs_fstat(ms_io_mnt_t *mnt, ms_io_file_t *file, ms_stat_t *buf)
 {
-    FIL *fatfs_file = file->ctx;
+    __ms_fatfs_file_t *fobj = file->ctx;
 
     bzero(buf, sizeof(ms_stat_t));
 
-    buf->st_size = f_size(fatfs_file);
+    (void)ms_mutex_lock(fobj->lock, MS_TIMEOUT_FOREVER);
+    buf->st_size = f_size(&fobj->fil);
+    (void)ms_mutex_unlock(fobj->lock);
     buf->st_mode = S_IRWXU | S_IRWXG | S_IRWXO | S_IFREG;
 
     return 0;
@@ -371,30 +1398,54 @@ static int __ms_fatfs_isatty(ms_io_mnt_t *mnt, ms_io_file_t *file)
     return 0;
 }
 
-static int __ms_fatfs_fsync(ms_io_mnt_t *mnt, ms_io_file_t *file)
+static int __ms_fatfs_sync(ms_io_mnt_t *mnt, ms_io_file_t *file, BYTE opt)
 {
-    FIL *fatfs_file = file->ctx;
+    __ms_fatfs_file_t *fobj = file->ctx;
+    __ms_fatfs_mark_t mark;
     FRESULT fresult;
     int ret;
 
-    fresult = f_sync(fatfs_file);
+    (void)ms_mutex_lock(fobj->lock, MS_TIMEOUT_FOREVER);
+    __ms_fatfs_file_mark(mnt->ctx, fobj, &mark);
+    fresult = f_sync_ex(&fobj->fil, SY_NOFLUSH | opt);
+    (void)ms_mutex_unlock(fobj->lock);
+    if (fresult == FR_OK) {
+        fresult = __ms_fatfs_commit(mnt->ctx);
+    }
     if (fresult != FR_OK) {
         ms_thread_set_errno(__ms_fatfs_result_to_errno(fresult));
         ret = -1;
     } else {
+        __ms_fatfs_file_clean(mnt->ctx, fobj, &mark);
         ret = 0;
     }
 
     return ret;
 }
 
+static int __ms_fatfs_fsync(ms_io_mnt_t *mnt, ms_io_file_t *file)
+{
+    return __ms_fatfs_sync(mnt, file, 0U);
+}
+
+/*
+ * The directory entry is only written if the file size or allocation has changed
+ */
+static int __ms_fatfs_fdatasync(ms_io_mnt_t *mnt, ms_io_file_t *file)
+{
+    return __ms_fatfs_sync(mnt, file, SY_DATAONLY);
+}
+
 static int __ms_fatfs_ftruncate(ms_io_mnt_t *mnt, ms_io_file_t *file, ms_off_t len)
 {
-    FIL *fatfs_file = file->ctx;
+    __ms_fatfs_file_t *fobj = file->ctx;
+    FIL *fatfs_file = &fobj->fil;
     FRESULT fresult;
     FSIZE_t old_off;
     int ret;
 
+    (void)ms_mutex_lock(fobj->lock, MS_TIMEOUT_FOREVER);
+
     old_off = f_tell(fatfs_file);
 
     fresult = f_lseek(fatfs_file, len);
@@ -409,6 +1460,8 @@ static int __ms_fatfs_ftruncate(ms_io_mnt_t *mnt, ms_io_file_t *file, ms_off_t l
             ret = -1;
 
         } else {
+            __ms_fatfs_file_dirty(mnt->ctx, fobj, 0U);
+
             old_off = MS_MIN(len, old_off);
             fresult = f_lseek(fatfs_file, old_off);
             if (fresult != FR_OK) {
@@ -420,16 +1473,21 @@ static int __ms_fatfs_ftruncate(ms_io_mnt_t *mnt, ms_io_file_t *file, ms_off_t l
         }
     }
 
+    (void)ms_mutex_unlock(fobj->lock);
+
     return ret;
 }
 
 static ms_off_t __ms_fatfs_lseek(ms_io_mnt_t *mnt, ms_io_file_t *file, ms_off_t offset, int whence)
 {
-    FIL *fatfs_file = file->ctx;
+    __ms_fatfs_file_t *fobj = file->ctx;
+    FIL *fatfs_file = &fobj->fil;
     FRESULT fresult;
     ms_off_t ret;
     ms_off_t pos;
 
+    (void)ms_mutex_lock(fobj->lock, MS_TIMEOUT_FOREVER);
+
     ret = 0;
     switch (whence) {
     case SEEK_SET:
@@ -469,6 +1527,8 @@ static ms_off_t __ms_fatfs_lseek(ms_io_mnt_t *mnt, ms_io_file_t *file, ms_off_t
         ret = -1;
     }
 
+    (void)ms_mutex_unlock(fobj->lock);
+
     return ret;
 }
 
@@ -492,18 +1552,7 @@ static int __ms_fatfs_stat(ms_io_mnt_t *mnt, const char *path, ms_stat_t *buf)
             ret = -1;
 
         } else {
-            if (finfo.fattrib & AM_DIR) {
-                buf->st_mode = S_IFDIR;
-            } else {
-                buf->st_mode = S_IFREG;
-                buf->st_size = finfo.fsize;
-            }
-            if (finfo.fattrib & AM_RDO) {
-                buf->st_mode |= S_IRUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH;
-            } else {
-                buf->st_mode |= S_IRWXU | S_IRWXG | S_IRWXO;
-            }
-
+            __ms_fatfs_finfo_to_stat(&finfo, buf);
             ret = 0;
         }
     }
@@ -524,7 +1573,7 @@ static int __ms_fatfs_statvfs(ms_io_mnt_t *mnt, ms_statvfs_t *buf)
         ms_thread_set_errno(__ms_fatfs_result_to_errno(fresult));
         ret = -1;
     } else {
-        buf->f_bsize  = FF_MIN_SS;
+        buf->f_bsize  = MS_FATFS_SS(fatfs);
         buf->f_frsize = fatfs->csize * buf->f_bsize;
         buf->f_blocks = (fatfs->n_fatent - 2);
         buf->f_files  = 0UL;
@@ -579,29 +1628,62 @@ static int __ms_fatfs_mkdir(ms_io_mnt_t *mnt, const char *path, ms_mode_t mode)
     return ret;
 }
 
+/*
+ * Called by f_rename_ex() with the volume grant held, the replaced object is busy while
+ * a file or a directory is being opened, or while it is open
+ */
+static UINT __ms_fatfs_rename_busy(LBA_t sect, const BYTE *dir, DWORD sclust, void *arg)
+{
+    __ms_fatfs_mnt_t *ctx = arg;
+    __ms_fatfs_file_t *fobj;
+    __ms_fatfs_dir_t *dobj;
+    UINT ret;
+
+    (void)ms_mutex_lock(ctx->lock, MS_TIMEOUT_FOREVER);
+
+    ret = (ctx->opening > 0U) ? 1U : 0U;
+    for (fobj = ctx->files; (fobj != MS_NULL) && (ret == 0U); fobj = fobj->next) {
+        if ((fobj->fil.dir_sect == sect) && (fobj->fil.dir_ptr == dir)) {
+            ret = 1U;
+        }
+    }
+    for (dobj = ctx->dirs; (dobj != MS_NULL) && (ret == 0U) && (sclust != 0U); dobj = dobj->next) {
+        if (dobj->dir.obj.sclust == sclust) {
+            ret = 1U;
+        }
+    }
+
+    (void)ms_mutex_unlock(ctx->lock);
+
+    return ret;
+}
+
 static int __ms_fatfs_rename(ms_io_mnt_t *mnt, const char *old, const char *_new)
 {
-    FATFS *fatfs = mnt->ctx;
+    __ms_fatfs_mnt_t *ctx = mnt->ctx;
+    FATFS *fatfs = &ctx->fatfs;
+    FILINFO old_info;
+    FILINFO new_info;
     FRESULT fresult;
-    FILINFO finfo;
+    int err;
     int ret;
 
     /*
-     * Check if '_new' path exists; remove it first
+     * Replace '_new' path if exists, in the same operation
      */
-    fresult = f_stat(fatfs, _new, &finfo);
-    if (fresult == FR_OK) {
-        fresult = f_unlink(fatfs, _new);
-    } else {
-        fresult = FR_OK;
-    }
-
-    if (fresult == FR_OK) {
-        fresult = f_rename(fatfs, old, _new);
-    }
-
+    fresult = f_rename_ex(fatfs, old, _new, RN_REPLACE, __ms_fatfs_rename_busy, ctx);
     if (fresult != FR_OK) {
-        ms_thread_set_errno(__ms_fatfs_result_to_errno(fresult));
+        err = __ms_fatfs_result_to_errno(fresult);
+        if ((fresult == FR_EXIST) &&
+            (f_stat(fatfs, old, &old_info) == FR_OK) &&
+            (f_stat(fatfs, _new, &new_info) == FR_OK)) {
+            if ((new_info.fattrib & AM_DIR) && !(old_info.fattrib & AM_DIR)) {
+                err = EISDIR;           /* A file can not replace a directory */
+            } else if (!(new_info.fattrib & AM_DIR) && (old_info.fattrib & AM_DIR)) {
+                err = ENOTDIR;          /* A directory can not replace a file */
+            }
+        }
+        ms_thread_set_errno(err);
         ret = -1;
     } else {
         ret = 0;
@@ -612,8 +1694,8 @@ static int __ms_fatfs_rename(ms_io_mnt_t *mnt, const char *old, const char *_new
 
 static int __ms_fatfs_opendir(ms_io_mnt_t *mnt, ms_io_file_t *file, const char *path)
 {
-    FATFS *fatfs = mnt->ctx;
-    DIR *fatfs_dir;
+    __ms_fatfs_mnt_t *ctx = mnt->ctx;
+    __ms_fatfs_dir_t *dobj;
     FRESULT fresult;
     int ret;
 
@@ -621,15 +1703,34 @@ static int __ms_fatfs_opendir(ms_io_mnt_t *mnt, ms_io_file_t *file, const char *
         path = "/";
     }
 
-    fatfs_dir = ms_kzalloc(sizeof(DIR));
-    if (fatfs_dir != MS_NULL) {
-        fresult = f_opendir(fatfs, fatfs_dir, path);
+    dobj = __ms_fatfs_pool_get(ctx, &ctx->dir_pool);
+    if (dobj != MS_NULL) {
+        bzero(dobj, sizeof(__ms_fatfs_dir_t));
+        dobj->kind = MS_FATFS_OBJ_DIR;
+
+        (void)ms_mutex_lock(ctx->lock, MS_TIMEOUT_FOREVER);
+        ctx->opening++;
+        (void)ms_mutex_unlock(ctx->lock);
+
+        fresult = f_opendir(&ctx->fatfs, &dobj->dir, path);
+
+        (void)ms_mutex_lock(ctx->lock, MS_TIMEOUT_FOREVER);
+        ctx->opening--;
+        if (fresult == FR_OK) {
+            dobj->next = ctx->dirs;
+            if (ctx->dirs != MS_NULL) {
+                ctx->dirs->prev = dobj;
+            }
+            ctx->dirs = dobj;
+        }
+        (void)ms_mutex_unlock(ctx->lock);
+
         if (fresult != FR_OK) {
-            (void)ms_kfree(fatfs_dir);
+            __ms_fatfs_pool_put(ctx, &ctx->dir_pool, dobj);
             ms_thread_set_errno(__ms_fatfs_result_to_errno(fresult));
             ret = -1;
         } else {
-            file->ctx = fatfs_dir;
+            file->ctx = dobj;
             ret = 0;
         }
 
@@ -643,16 +1744,28 @@ static int __ms_fatfs_opendir(ms_io_mnt_t *mnt, ms_io_file_t *file, const char *
 
 static int __ms_fatfs_closedir(ms_io_mnt_t *mnt, ms_io_file_t *file)
 {
-    DIR *fatfs_dir = file->ctx;
+    __ms_fatfs_mnt_t *ctx = mnt->ctx;
+    __ms_fatfs_dir_t *dobj = file->ctx;
     FRESULT fresult;
     int ret;
 
-    fresult = f_closedir(fatfs_dir);
+    fresult = f_closedir(&dobj->dir);
     if ((fresult != FR_OK) && !mnt->umount_req) {
         ms_thread_set_errno(__ms_fatfs_result_to_errno(fresult));
         ret = -1;
     } else {
-        (void)ms_kfree(fatfs_dir);
+        (void)ms_mutex_lock(ctx->lock, MS_TIMEOUT_FOREVER);
+        if (dobj->prev != MS_NULL) {
+            dobj->prev->next = dobj->next;
+        } else {
+            ctx->dirs = dobj->next;
+        }
+        if (dobj->next != MS_NULL) {
+            dobj->next->prev = dobj->prev;
+        }
+        (void)ms_mutex_unlock(ctx->lock);
+
+        __ms_fatfs_pool_put(ctx, &ctx->dir_pool, dobj);
         file->ctx = MS_NULL;
         ret = 0;
     }
@@ -662,7 +1775,7 @@ static int __ms_fatfs_closedir(ms_io_mnt_t *mnt, ms_io_file_t *file)
 
 static int __ms_fatfs_readdir_r(ms_io_mnt_t *mnt, ms_io_file_t *file, ms_dirent_t *entry, ms_dirent_t **result)
 {
-    DIR *fatfs_dir = file->ctx;
+    DIR *fatfs_dir = &((__ms_fatfs_dir_t *)file->ctx)->dir;
     FILINFO finfo;
     FRESULT fresult;
     int ret;
@@ -701,7 +1814,7 @@ static int __ms_fatfs_readdir_r(ms_io_mnt_t *mnt, ms_io_file_t *file, ms_dirent_
 
 static int __ms_fatfs_rewinddir(ms_io_mnt_t *mnt, ms_io_file_t *file)
 {
-    DIR *fatfs_dir = file->ctx;
+    DIR *fatfs_dir = &((__ms_fatfs_dir_t *)file->ctx)->dir;
     FRESULT fresult;
     int ret;
 
@@ -718,7 +1831,7 @@ static int __ms_fatfs_rewinddir(ms_io_mnt_t *mnt, ms_io_file_t *file)
 
 static int __ms_fatfs_seekdir(ms_io_mnt_t *mnt, ms_io_file_t *file, long loc)
 {
-    DIR *fatfs_dir = file->ctx;
+    DIR *fatfs_dir = &((__ms_fatfs_dir_t *)file->ctx)->dir;
     FRESULT fresult;
     FILINFO finfo;
     long dptr;
@@ -757,11 +1870,314 @@ static int __ms_fatfs_seekdir(ms_io_mnt_t *mnt, ms_io_file_t *file, long loc)
 
 static long __ms_fatfs_telldir(ms_io_mnt_t *mnt, ms_io_file_t *file)
 {
-    DIR *fatfs_dir = file->ctx;
+    DIR *fatfs_dir = &((__ms_fatfs_dir_t *)file->ctx)->dir;
 
     return fatfs_dir->dptr;
 }
 
+/*
+ * Batch readdir context
+ */
+typedef struct {
+    ms_uint8_t *pos;
+    ms_size_t   left;
+} __ms_fatfs_getdents_ctx_t;
+
+static UINT __ms_fatfs_getdents_fill(const FILINFO *finfo, void *arg)
+{
+    __ms_fatfs_getdents_ctx_t *ctx = arg;
+    ms_fatfs_dirent_t *dirent;
+    ms_size_t namlen;
+    ms_uint16_t reclen;
+    UINT ret;
+
+    namlen = strlen(finfo->fname);
+    reclen = MS_FATFS_DIRENT_RECLEN(namlen);
+    if (reclen <= ctx->left) {
+        dirent = (ms_fatfs_dirent_t *)ctx->pos;
+        dirent->d_reclen = reclen;
+        dirent->d_namlen = (ms_uint16_t)namlen;
+        dirent->d_type   = (finfo->fattrib & AM_DIR) ? DT_DIR : DT_REG;
+        memcpy(dirent->d_name, finfo->fname, namlen + 1U);
+
+        ctx->pos  += reclen;
+        ctx->left -= reclen;
+        ret = 1U;
+
+    } else {
+        ret = 0U;
+    }
+
+    return ret;
+}
+
+static int __ms_fatfs_getdents(ms_io_mnt_t *mnt, ms_io_file_t *file, ms_fatfs_getdents_t *param)
+{
+    DIR *fatfs_dir = &((__ms_fatfs_dir_t *)file->ctx)->dir;
+    __ms_fatfs_getdents_ctx_t ctx;
+    FILINFO finfo;
+    FRESULT fresult;
+    UINT nr;
+    int ret;
+
+    if (MS_FATFS_OBJ_KIND(file->ctx) != MS_FATFS_OBJ_DIR) {
+        ms_thread_set_errno(ENOTDIR);
+        ret = -1;
+
+    } else if ((param == MS_NULL) || (param->buf == MS_NULL)) {
+        ms_thread_set_errno(EFAULT);
+        ret = -1;
+
+    } else {
+        ctx.pos  = param->buf;
+        ctx.left = param->len;
+
+        fresult = f_readdir_batch(fatfs_dir, &finfo, __ms_fatfs_getdents_fill, &ctx, &nr);
+        if (fresult != FR_OK) {
+            ms_thread_set_errno(__ms_fatfs_result_to_errno(fresult));
+            ret = -1;
+
+        } else if ((nr == 0U) && (fatfs_dir->sect != 0U)) {
+            /*
+             * Not at the end, but the buffer can not hold the next entry
+             */
+            ms_thread_set_errno(EINVAL);
+            ret = -1;
+
+        } else {
+            param->nbytes   = param->len - ctx.left;
+            param->nentries = nr;
+            ret = 0;
+        }
+    }
+
+    return ret;
+}
+
+static int __ms_fatfs_readdir_plus(ms_io_mnt_t *mnt, ms_io_file_t *file, ms_fatfs_direntplus_t *param)
+{
+    DIR *fatfs_dir = &((__ms_fatfs_dir_t *)file->ctx)->dir;
+    FILINFO finfo;
+    FRESULT fresult;
+    int ret;
+
+    if (MS_FATFS_OBJ_KIND(file->ctx) != MS_FATFS_OBJ_DIR) {
+        ms_thread_set_errno(ENOTDIR);
+        ret = -1;
+
+    } else if (param == MS_NULL) {
+        ms_thread_set_errno(EFAULT);
+        ret = -1;
+
+    } else {
+        bzero(param, sizeof(ms_fatfs_direntplus_t));
+
+        fresult = f_readdir(fatfs_dir, &finfo);
+        if (fresult != FR_OK) {
+            ms_thread_set_errno(__ms_fatfs_result_to_errno(fresult));
+            ret = -1;
+
+        } else {
+            if (finfo.fname[0] != '\0') {
+                strlcpy(param->d_entry.d_name, finfo.fname, sizeof(param->d_entry.d_name));
+                param->d_entry.d_type = (finfo.fattrib & AM_DIR) ? DT_DIR : DT_REG;
+                __ms_fatfs_finfo_to_stat(&finfo, &param->d_stat);
+            }
+
+            ret = 0;
+        }
+    }
+
+    return ret;
+}
+
+static int __ms_fatfs_rmtree(ms_io_mnt_t *mnt, const char *path)
+{
+    FATFS *fatfs = mnt->ctx;
+    FRESULT fresult;
+    int ret;
+
+    if (path == MS_NULL) {
+        ms_thread_set_errno(EFAULT);
+        ret = -1;
+
+    } else {
+        fresult = f_rmtree(fatfs, path);
+        if (fresult != FR_OK) {
+            ms_thread_set_errno(__ms_fatfs_result_to_errno(fresult));
+            ret = -1;
+        } else {
+            ret = 0;
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * Called by f_compactdir() with the volume grant held, the directory is busy while a file
+ * or a directory is being opened, while it is open itself or while an open file has its
+ * entry in one of its sectors. An open made after the check waits for the grant, so it
+ * sees the compacted directory.
+ */
+static UINT __ms_fatfs_compactdir_busy(DWORD sclust, LBA_t sect, void *arg)
+{
+    __ms_fatfs_mnt_t *ctx = arg;
+    __ms_fatfs_file_t *fobj;
+    __ms_fatfs_dir_t *dobj;
+    UINT ret;
+
+    (void)ms_mutex_lock(ctx->lock, MS_TIMEOUT_FOREVER);
+
+    ret = (ctx->opening > 0U) ? 1U : 0U;
+    for (fobj = ctx->files; (fobj != MS_NULL) && (ret == 0U); fobj = fobj->next) {
+        if (fobj->fil.dir_sect == sect) {
+            ret = 1U;
+        }
+    }
+    for (dobj = ctx->dirs; (dobj != MS_NULL) && (ret == 0U); dobj = dobj->next) {
+        if (dobj->dir.obj.sclust == sclust) {
+            ret = 1U;
+        }
+    }
+
+    (void)ms_mutex_unlock(ctx->lock);
+
+    return ret;
+}
+
+static int __ms_fatfs_compactdir(ms_io_mnt_t *mnt, ms_fatfs_compactdir_t *param)
+{
+    __ms_fatfs_mnt_t *ctx = mnt->ctx;
+    FATFS *fatfs = &ctx->fatfs;
+    FRESULT fresult;
+    ms_ptr_t work;
+    int ret;
+
+    if ((param == MS_NULL) || (param->path == MS_NULL)) {
+        ms_thread_set_errno(EFAULT);
+        ret = -1;
+
+    } else {
+        work = ms_kmalloc(FF_MAX_SS);
+        if (work != MS_NULL) {
+            fresult = f_compactdir(fatfs, param->path, param->threshold, work,
+                                   __ms_fatfs_compactdir_busy, ctx);
+            (void)ms_kfree(work);
+            if (fresult != FR_OK) {
+                ms_thread_set_errno(__ms_fatfs_result_to_errno(fresult));
+                ret = -1;
+            } else {
+                ret = 0;
+            }
+        } else {
+            ms_thread_set_errno(ENOMEM);
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+static int __ms_fatfs_poolstat(ms_io_mnt_t *mnt, ms_fatfs_poolstat_t *param)
+{
+    __ms_fatfs_mnt_t *ctx = mnt->ctx;
+    int ret;
+
+    if (param != MS_NULL) {
+        (void)ms_mutex_lock(ctx->lock, MS_TIMEOUT_FOREVER);
+        param->file = ctx->file_pool.stat;
+        param->dir  = ctx->dir_pool.stat;
+        (void)ms_mutex_unlock(ctx->lock);
+        ret = 0;
+    } else {
+        ms_thread_set_errno(EFAULT);
+        ret = -1;
+    }
+
+    return ret;
+}
+
+static int __ms_fatfs_pooltrim(ms_io_mnt_t *mnt)
+{
+    __ms_fatfs_mnt_t *ctx = mnt->ctx;
+
+    (void)ms_mutex_lock(ctx->lock, MS_TIMEOUT_FOREVER);
+    __ms_fatfs_pool_trim(&ctx->file_pool, ctx->file_pool.stat.low);
+    __ms_fatfs_pool_trim(&ctx->dir_pool, ctx->dir_pool.stat.low);
+    (void)ms_mutex_unlock(ctx->lock);
+
+    return 0;
+}
+
+static int __ms_fatfs_mergestat(ms_io_mnt_t *mnt, ms_fatfs_mergestat_t *param)
+{
+    FATFS *fatfs = mnt->ctx;
+    int ret;
+
+    if (param != MS_NULL) {
+        (void)disk_mergestat(fatfs->pdrv, param);
+        ret = 0;
+    } else {
+        ms_thread_set_errno(EFAULT);
+        ret = -1;
+    }
+
+    return ret;
+}
+
+static int __ms_fatfs_ioctl(ms_io_mnt_t *mnt, ms_io_file_t *file, int cmd, ms_ptr_t arg)
+{
+    int ret;
+
+    switch (cmd) {
+    case MS_FATFS_CMD_GETDENTS:
+        ret = __ms_fatfs_getdents(mnt, file, arg);
+        break;
+
+    case MS_FATFS_CMD_READDIR_PLUS:
+        ret = __ms_fatfs_readdir_plus(mnt, file, arg);
+        break;
+
+    case MS_FATFS_CMD_RMTREE:
+        ret = __ms_fatfs_rmtree(mnt, arg);
+        break;
+
+    case MS_FATFS_CMD_COMPACTDIR:
+        ret = __ms_fatfs_compactdir(mnt, arg);
+        break;
+
+    case MS_FATFS_CMD_POOLSTAT:
+        ret = __ms_fatfs_poolstat(mnt, arg);
+        break;
+
+    case MS_FATFS_CMD_POOLTRIM:
+        ret = __ms_fatfs_pooltrim(mnt);
+        break;
+
+#if MS_FATFS_AIO_WORKERS > 0
+    case MS_FATFS_CMD_AIO_SUBMIT:
+        ret = __ms_fatfs_aio_submit(mnt, file, arg);
+        break;
+
+    case MS_FATFS_CMD_AIO_REAP:
+        ret = __ms_fatfs_aio_reap(mnt, arg);
+        break;
+#endif
+
+    case MS_FATFS_CMD_MERGESTAT:
+        ret = __ms_fatfs_mergestat(mnt, arg);
+        break;
+
+    default:
+        ms_thread_set_errno(EINVAL);
+        ret = -1;
+        break;
+    }
+
+    return ret;
+}
+
 static ms_io_fs_ops_t ms_io_fatfs_ops = {
         .type       = MS_IO_FS_TYPE_DISKFS,
         .mount      = __ms_fatfs_mount,
@@ -784,12 +2200,12 @@ static ms_io_fs_ops_t ms_io_fatfs_ops = {
         .close      = __ms_fatfs_close,
         .read       = __ms_fatfs_read,
         .write      = __ms_fatfs_write,
-        .ioctl      = MS_NULL,
+        .ioctl      = __ms_fatfs_ioctl,
         .fcntl      = __ms_fatfs_fcntl,
         .fstat      = __ms_fatfs_fstat,
         .isatty     = __ms_fatfs_isatty,
         .fsync      = __ms_fatfs_fsync,
-        .fdatasync  = __ms_fatfs_fsync,
+        .fdatasync  = __ms_fatfs_fdatasync,
         .ftruncate  = __ms_fatfs_ftruncate,
         .lseek      = __ms_fatfs_lseek,
         .poll       = MS_NULL,
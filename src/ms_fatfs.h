@@ -19,6 +19,166 @@ extern "C" {
 
 #define MS_FATFS_NAME       "fatfs"
 
+/*
+ * Open flag for sector aligned transfers between the user buffer and the device,
+ * without the sector buffer of the file
+ */
+#ifndef O_DIRECT
+#define O_DIRECT            0x80000
+#endif
+
+/*
+ * FATFS specific ioctl commands
+ */
+#define MS_FATFS_CMD_GETDENTS       (('F' << 8) | 1)    /* arg: ms_fatfs_getdents_t *, on directory */
+#define MS_FATFS_CMD_READDIR_PLUS   (('F' << 8) | 2)    /* arg: ms_fatfs_direntplus_t *, on directory */
+#define MS_FATFS_CMD_RMTREE         (('F' << 8) | 3)    /* arg: const char * path relative to the mount point */
+#define MS_FATFS_CMD_COMPACTDIR     (('F' << 8) | 4)    /* arg: ms_fatfs_compactdir_t * */
+#define MS_FATFS_CMD_POOLSTAT       (('F' << 8) | 5)    /* arg: ms_fatfs_poolstat_t * */
+#define MS_FATFS_CMD_POOLTRIM       (('F' << 8) | 6)    /* arg: none, free pooled objects above the low watermark */
+#define MS_FATFS_CMD_AIO_SUBMIT     (('F' << 8) | 7)    /* arg: ms_fatfs_aiocb_t *, on file */
+#define MS_FATFS_CMD_AIO_REAP       (('F' << 8) | 8)    /* arg: ms_fatfs_aioreap_t * */
+#define MS_FATFS_CMD_MERGESTAT      (('F' << 8) | 9)    /* arg: ms_fatfs_mergestat_t * */
+
+/*
+ * Optional block device driver ioctl commands for scatter-gather transfers.
+ * A driver without them fails the command and the segments are transferred one by one.
+ */
+#define MS_FATFS_BLKDEV_CMD_READV   (('F' << 8) | 0x80) /* arg: ms_fatfs_blkvec_t * */
+#define MS_FATFS_BLKDEV_CMD_WRITEV  (('F' << 8) | 0x81) /* arg: ms_fatfs_blkvec_t * */
+
+/*
+ * Packed directory entry returned by MS_FATFS_CMD_GETDENTS
+ */
+typedef struct {
+    ms_uint16_t d_reclen;       /* Length of this record, multiple of 4 */
+    ms_uint16_t d_namlen;       /* Length of d_name, not including '\0' */
+    ms_uint8_t  d_type;         /* DT_DIR or DT_REG */
+    char        d_name[1];      /* Null-terminated name */
+} ms_fatfs_dirent_t;
+
+#define MS_FATFS_DIRENT_RECLEN(namlen) \
+    ((ms_uint16_t)((sizeof(ms_fatfs_dirent_t) + (namlen) + 3U) & ~3U))
+
+#define MS_FATFS_DIRENT_NEXT(dirent) \
+    ((ms_fatfs_dirent_t *)((ms_uint8_t *)(dirent) + (dirent)->d_reclen))
+
+/*
+ * MS_FATFS_CMD_GETDENTS argument, buf must be 4 bytes aligned.
+ * nentries is 0 at the end of the directory.
+ */
+typedef struct {
+    ms_ptr_t    buf;            /* Buffer to receive ms_fatfs_dirent_t records */
+    ms_size_t   len;            /* Size of buf */
+    ms_size_t   nbytes;         /* [out] Number of bytes filled */
+    ms_uint32_t nentries;       /* [out] Number of records filled */
+} ms_fatfs_getdents_t;
+
+/*
+ * MS_FATFS_CMD_READDIR_PLUS argument, d_entry.d_name[0] is '\0' at the end of the directory.
+ * d_stat is filled from the directory entry just read, no extra path lookup is needed.
+ */
+typedef struct {
+    ms_dirent_t d_entry;        /* [out] Directory entry */
+    ms_stat_t   d_stat;         /* [out] Status of the entry */
+} ms_fatfs_direntplus_t;
+
+/*
+ * MS_FATFS_CMD_COMPACTDIR argument.
+ * It fails with EBUSY while the directory or a file in it is open.
+ */
+typedef struct {
+    const char *path;           /* Directory path relative to the mount point */
+    ms_uint32_t threshold;      /* Minimum number of deleted entries to compact, 0: always */
+} ms_fatfs_compactdir_t;
+
+/*
+ * Statistics of an object pool
+ */
+typedef struct {
+    ms_uint32_t low;            /* Low watermark */
+    ms_uint32_t high;           /* High watermark */
+    ms_uint32_t nfree;          /* Number of free objects in the pool */
+    ms_uint32_t ninuse;         /* Number of objects in use */
+    ms_uint32_t peak;           /* Maximum of ninuse */
+    ms_uint32_t hits;           /* Allocations served from the pool */
+    ms_uint32_t misses;         /* Allocations served from the kernel heap */
+    ms_uint32_t releases;       /* Objects returned to the kernel heap */
+} ms_fatfs_pool_stat_t;
+
+/*
+ * MS_FATFS_CMD_POOLSTAT argument
+ */
+typedef struct {
+    ms_fatfs_pool_stat_t file;  /* [out] File objects with their sector buffers */
+    ms_fatfs_pool_stat_t dir;   /* [out] Directory objects */
+} ms_fatfs_poolstat_t;
+
+/*
+ * Asynchronous request opcodes
+ */
+#define MS_FATFS_AIO_READ           0U
+#define MS_FATFS_AIO_WRITE          1U
+
+/*
+ * MS_FATFS_CMD_AIO_SUBMIT argument, it must stay valid until the request completes.
+ * Requests on a file are served in submission order, requests on different files in parallel.
+ * The file must not be read or written directly while it has requests in flight,
+ * close() waits for them to complete.
+ */
+typedef struct ms_fatfs_aiocb {
+    struct ms_fatfs_aiocb *next;    /* Private */
+    ms_uint32_t opcode;             /* MS_FATFS_AIO_READ or MS_FATFS_AIO_WRITE */
+    ms_off_t    offset;             /* File offset, -1: current file position */
+    ms_ptr_t    buf;                /* Data buffer */
+    ms_size_t   len;                /* Number of bytes to transfer */
+    void      (*callback)(struct ms_fatfs_aiocb *aiocb);
+                                    /* Called by the worker on completion, MS_NULL: queued for MS_FATFS_CMD_AIO_REAP */
+    ms_ptr_t    arg;                /* User data */
+    ms_ssize_t  result;             /* [out] Number of bytes transferred, -1 on error */
+    int         error;              /* [out] errno of the request, EINPROGRESS until it completes */
+} ms_fatfs_aiocb_t;
+
+/*
+ * MS_FATFS_CMD_AIO_REAP argument, waits for the first completion then returns what is queued.
+ */
+typedef struct {
+    ms_fatfs_aiocb_t **list;        /* Array to receive completed requests */
+    ms_uint32_t nr;                 /* Size of list */
+    ms_uint32_t timeout;            /* Ticks to wait for the first completion */
+    ms_uint32_t nreaped;            /* [out] Number of requests returned */
+} ms_fatfs_aioreap_t;
+
+/*
+ * MS_FATFS_CMD_MERGESTAT argument, statistics of the write merging below FatFs.
+ * The merge ratio is nreq / nblk.
+ */
+typedef struct {
+    ms_uint32_t nreq;           /* Write requests from FatFs */
+    ms_uint32_t nsect;          /* Sectors in them */
+    ms_uint32_t nblk;           /* Write requests issued to the driver, a vector counts its segments */
+    ms_uint32_t nover;          /* Held sectors written again before they were issued */
+    ms_uint32_t nhit;           /* Sectors read from the held writes */
+    ms_uint32_t nunplug;        /* Times the held writes were issued */
+} ms_fatfs_mergestat_t;
+
+/*
+ * Segment of a scatter-gather transfer
+ */
+typedef struct {
+    ms_uint32_t sector;         /* Start sector */
+    ms_uint32_t count;          /* Number of sectors */
+    ms_ptr_t    buf;            /* Data buffer */
+} ms_fatfs_blkseg_t;
+
+/*
+ * MS_FATFS_BLKDEV_CMD_READV and MS_FATFS_BLKDEV_CMD_WRITEV argument
+ */
+typedef struct {
+    const ms_fatfs_blkseg_t *seg;   /* Segment list, in no particular sector order */
+    ms_uint32_t nseg;               /* Number of segments */
+} ms_fatfs_blkvec_t;
+
 ms_err_t ms_fatfs_register(void);
 
 #ifdef __cplusplus
@@ -79,6 +79,25 @@
 /* This option switches f_forward() function. (0:Disable or 1:Enable) */
 
 
+#define FF_USE_READDIR_BATCH    1
+/* This option switches f_readdir_batch() function, which reads as many directory
+/  items as the callback accepts under a single volume lock. (0:Disable or 1:Enable)
+/  FF_FS_MINIMIZE needs to be 0 or 1 to enable this option. */
+
+
+#define FF_USE_RMTREE   1
+/* This option switches f_rmtree() function, which removes a file or a directory
+/  tree in a single traversal. (0:Disable or 1:Enable) FF_FS_READONLY and
+/  FF_FS_MINIMIZE need to be 0 to enable this option. exFAT is not supported. */
+
+
+#define FF_USE_COMPACTDIR   1
+/* This option switches f_compactdir() function, which moves the live entries of
+/  a directory over the deleted ones and frees the unused clusters at the end.
+/  (0:Disable or 1:Enable) FF_FS_READONLY and FF_FS_MINIMIZE need to be 0 to
+/  enable this option. exFAT is not supported. */
+
+
 /*---------------------------------------------------------------------------/
 / Locale and Namespace Configurations
 /---------------------------------------------------------------------------*/
@@ -112,6 +131,19 @@
 */
 
 
+#define FF_DBCS_DIRECT  1
+/* This option selects the conversion tables used by ff_uni2oem() and ff_oem2uni()
+/  for the DBCS code pages (932, 936, 949 and 950).
+/
+/   0: Sorted code pairs searched in binary. (up to 16 probes per character)
+/   1: Direct-indexed two-level tables. (one page lookup per character)
+/
+/  Size of the tables in ROM for each code page (pairs / direct):
+/  932: 58 KiB / 72 KiB, 936: 170 KiB / 115 KiB, 949: 133 KiB / 135 KiB,
+/  950: 106 KiB / 92 KiB. When FF_CODE_PAGE is not DBCS or 0, this option has
+/  no effect. */
+
+
 #define FF_USE_LFN      3
 #define FF_MAX_LFN      255
 /* The FF_USE_LFN switches the support for LFN (long file name).
@@ -132,7 +164,26 @@
 /  ff_memfree() exemplified in ffsystem.c, need to be added to the project. */
 
 
-#define FF_LFN_UNICODE  0
+#define FF_LFN_VOLBUF       1
+/* This option switches the LFN working buffer per volume at FF_USE_LFN == 3.
+/  (0:Allocate on every call or 1:Provided per volume)
+/  When enabled, path functions do not call ff_memalloc() and ff_memfree().
+/  Instead, FATFS.lfnbuf needs to point to a working buffer of the size
+/  described above before f_mount() is called, and it stays in use until the
+/  volume is unmounted. The buffer is only used under the volume grant. */
+
+
+#define FF_WTOUPPER_DIRECT  1
+/* This option selects the Unicode up-case conversion table used by ff_wtoupper().
+/
+/   0: Compressed table walked per character. (about 0.7 KiB of ROM)
+/   1: Direct-indexed two-level table. (about 7.3 KiB of ROM)
+/
+/  ASCII characters are converted without table in both cases.
+/  When LFN is not enabled, this option has no effect. */
+
+
+#define FF_LFN_UNICODE  2
 /* This option switches the character encoding on the API when LFN is enabled.
 /
 /   0: ANSI/OEM in current CP (TCHAR = char)
@@ -145,11 +196,13 @@
 
 
 #define FF_LFN_BUF      255
-#define FF_SFN_BUF      12
+#define FF_SFN_BUF      34
 /* This set of options defines size of file name members in the FILINFO structure
 /  which is used to read out directory items. These values should be suffcient for
 /  the file names to read. The maximum possible length of the read file name depends
-/  on character encoding. When LFN is not enabled, these options have no effect. */
+/  on character encoding. When LFN is not enabled, these options have no effect.
+/  In UTF-8 API, FF_LFN_BUF counts bytes, so 255 matches the POSIX NAME_MAX, and
+/  FF_SFN_BUF is 34 so that an 8.3 name of extended characters still fits. */
 
 
 #define FF_STRF_ENCODE  3
@@ -206,7 +259,7 @@
 
 
 #define FF_MIN_SS       512
-#define FF_MAX_SS       512
+#define FF_MAX_SS       4096
 /* This set of options configures the range of sector size to be supported. (512,
 /  1024, 2048 or 4096) Always set both 512 for most systems, generic memory card and
 /  harddisk. But a larger value may be required for on-board flash memory and some
@@ -225,12 +278,22 @@
 /  f_fdisk function. 0x100000000 max. This option has no effect when FF_LBA64 == 0. */
 
 
-#define FF_USE_TRIM     0
+#define FF_USE_TRIM     1
 /* This option switches support for ATA-TRIM. (0:Disable or 1:Enable)
 /  To enable Trim function, also CTRL_TRIM command should be implemented to the
 /  disk_ioctl() function. */
 
 
+#define FF_FS_SGIO      8
+/* This option sets the maximum number of segments in a vectored disk transfer.
+/  (0:Disable or 1-255)
+/  When enabled, f_read() and f_write() gather the whole sector transfers of a
+/  fragmented file into segment lists and the FAT mirror is written together with
+/  the 1st FAT, through disk_readv() and disk_writev() function, which must be
+/  added to the disk I/O layer. Each segment list takes 12 bytes per segment (16
+/  bytes at FF_LBA64 == 1) on the stack of f_read() and f_write(). */
+
+
 
 /*---------------------------------------------------------------------------/
 / System Configurations
@@ -243,6 +306,13 @@
 /  buffer in the filesystem object (FATFS) is used for the file data transfer. */
 
 
+#define FF_USE_MEMFUNC  1
+/* This option selects the memory functions used internally for sector buffer copy,
+/  fill and compare. (0:Built-in byte loops or 1:C library memcpy/memset/memcmp)
+/  The C library versions are usually word-at-a-time or hand optimized for the
+/  target. Set 0 if <string.h> is not available. */
+
+
 #define FF_FS_EXFAT     0
 /* This option switches support for exFAT filesystem. (0:Disable or 1:Enable)
 /  To enable exFAT, also LFN needs to be enabled. (FF_USE_LFN >= 1)
@@ -290,7 +360,7 @@
 /* #include <somertos.h>    // O/S definitions */
 #define FF_FS_REENTRANT 1
 #define FF_FS_TIMEOUT   1000
-#define FF_SYNC_t       ms_handle_t
+#define FF_SYNC_t       struct ms_fatfs_sync *
 /* The option FF_FS_REENTRANT switches the re-entrancy (thread safe) of the FatFs
 /  module itself. Note that regardless of this option, file access to different
 /  volume is always re-entrant and volume control functions, f_mount(), f_mkfs()
@@ -309,6 +379,102 @@
 /  included somewhere in the scope of ff.h. */
 
 
+#define FF_FS_RWLOCK    1
+/* This option switches the shared volume grant. (0:Disable or 1:Enable)
+/  When enabled, f_read() holds the volume in shared mode so that reads of
+/  different files proceed in parallel, and any other function holds it in
+/  exclusive mode. Shared holders serialize only on the sector window, which is
+/  used to follow the FAT. Also user provided handlers, ff_req_grant_shared(),
+/  ff_rel_grant_shared(), ff_req_window() and ff_rel_window() function, must be
+/  added to the project. A file object must not be read by two tasks at a time.
+/  This option has no effect when FF_FS_REENTRANT == 0 and cannot be used with
+/  FF_FS_TINY == 1. */
+
+
+#define FF_FS_XFER_UNLOCK   1
+/* This option switches unlocked data transfer. (0:Disable or 1:Enable)
+/  When enabled, f_read() and f_write() release the volume grant while they
+/  transfer whole sectors between the device and the caller's buffer, and take
+/  it back for the FAT and directory updates. Freeing of clusters waits for such
+/  transfers to finish. Also user provided handlers, ff_rel_grant_xfer(),
+/  ff_req_grant_xfer() and ff_wait_xfer() function, must be added to the
+/  project. This option has no effect when FF_FS_REENTRANT == 0 and cannot be
+/  used with FF_FS_TINY == 1. */
+
+
+
+/*---------------------------------------------------------------------------/
+/ MS-RTOS Adapter Configurations
+/---------------------------------------------------------------------------*/
+
+#define MS_FATFS_FILE_POOL_LOW  4
+#define MS_FATFS_FILE_POOL_HIGH 16
+#define MS_FATFS_DIR_POOL_LOW   2
+#define MS_FATFS_DIR_POOL_HIGH  8
+/* These options set the watermarks of the per mount object pools, which hold
+/  the file objects with their sector buffers and the directory objects
+/  released by close() and closedir().
+/  The low watermark is the number of free objects allocated at mount time and
+/  kept by MS_FATFS_CMD_POOLTRIM. The high watermark is the maximum number of
+/  free objects, objects released above it go back to the kernel heap.
+/  Set both to 0 to allocate on every open. */
+
+
+#define MS_FATFS_AIO_WORKERS    2
+#define MS_FATFS_AIO_PRIO       8
+#define MS_FATFS_AIO_STK_SIZE   2048
+/* The option MS_FATFS_AIO_WORKERS sets the number of worker tasks per mount that
+/  serve the requests of MS_FATFS_CMD_AIO_SUBMIT. The workers are created at the
+/  first submission. Set it to 0 to remove asynchronous I/O.
+/  Requests on different files run in parallel only as far as the volume grant
+/  allows, see FF_FS_RWLOCK and FF_FS_XFER_UNLOCK. */
+
+
+#define MS_FATFS_FLUSH_AGE      2000
+#define MS_FATFS_FLUSH_BYTES    (256U * 1024U)
+#define MS_FATFS_FLUSH_PRIO     9
+#define MS_FATFS_FLUSH_STK_SIZE 2048
+/* The option MS_FATFS_FLUSH_AGE sets the time in ticks after which a file written
+/  and not synced since is synced by the background flusher task of the mount.
+/  All dirty files are synced as soon as MS_FATFS_FLUSH_BYTES bytes have been
+/  written to the open files of the mount since they were last synced. The
+/  flusher is created at the first write. Set it to 0 to remove the flusher. */
+
+
+#define MS_FATFS_TRIM_QUEUE     16
+#define MS_FATFS_TRIM_MIN       8
+/* These options configure the discard queue used at FF_USE_TRIM == 1. The option
+/  MS_FATFS_TRIM_QUEUE sets the number of sector ranges queued per mount. Freed
+/  ranges are merged with the adjacent queued ones and issued with
+/  MS_BLKDEV_CMD_TRIM after the volume is flushed by fsync or the flusher, and at
+/  mkfs. A range freed while the volume is flushing waits for the next flush. A
+/  full queue drops its shortest range, and the ranges left at unmount or at a new
+/  initialization of the drive are dropped. Ranges shorter than MS_FATFS_TRIM_MIN sectors are dropped. Set
+/  MS_FATFS_TRIM_QUEUE to 0 to trim at once. */
+
+
+#define MS_FATFS_PLUG_SIZE      (16U * 1024U)
+#define MS_FATFS_PLUG_AGE       20
+/* These options configure the write merging below FatFs. Writes of up to
+/  MS_FATFS_PLUG_SIZE bytes are held per mount, sorted and issued as one writeblk
+/  per run of adjacent sectors when the buffer is full, on CTRL_SYNC, by each pass
+/  of the flusher, or by a write that comes when the oldest one has been held for
+/  MS_FATFS_PLUG_AGE ticks. The age is not checked without a write, so with
+/  MS_FATFS_FLUSH_AGE set to 0 the held writes stay held until the next sync or
+/  write. A held write that fails stays held, each sync tries it again and fails
+/  until it is written. Set MS_FATFS_PLUG_SIZE to 0 to write at once. */
+
+
+#define MS_FATFS_BOUNCE_NR      2
+#define MS_FATFS_BOUNCE_SIZE    (8U * 1024U)
+/* These options configure the bounce buffers of a mount. A sector transfer to a
+/  buffer not aligned to MS_ARCH_CACHE_LINE_SIZE, such as the caller's buffer of a
+/  multi-sector f_read or f_write, is staged in pieces of MS_FATFS_BOUNCE_SIZE
+/  bytes through one of MS_FATFS_BOUNCE_NR aligned buffers, so that the driver can
+/  use DMA. MS_FATFS_BOUNCE_SIZE must be a multiple of FF_MAX_SS. Set
+/  MS_FATFS_BOUNCE_NR to 0 to pass misaligned buffers to the driver. */
+
+
 
 /*--- End of configuration options ---*/
 
@@ -13,15 +13,775 @@
 #define __MS_IO
 #include "ms_kern.h"
 #include "ms_io_core.h"
+#include "ms_fatfs.h"
 
 #undef DIR
 #include "fatfs/source/ff.h"
 #include "fatfs/source/diskio.h"
 
+#include <string.h>
+
 /**
  * @brief FatFs porting.
  */
 
+/*
+ * Physical drive, FATFS::pdrv points to it
+ */
+struct ms_fatfs_drive {
+    ms_io_device_t *dev;
+#if FF_USE_TRIM && MS_FATFS_TRIM_QUEUE > 0
+    ms_handle_t     trim_lock;  /* Protects the discard queue, held while it is issued */
+    ms_uint32_t     trim_nr;
+    LBA_t           trim_range[MS_FATFS_TRIM_QUEUE][2]; /* Start and end sector */
+    ms_bool_t       trim_ready[MS_FATFS_TRIM_QUEUE];    /* Freed by a FAT known to be on the disk */
+#endif
+#if MS_FATFS_PLUG_SIZE > 0
+    ms_handle_t     plug_lock;  /* Protects the held writes, held while they are issued */
+    BYTE           *plug_buf;   /* Held sectors and one spare sector to sort them */
+    UINT            plug_ssize; /* Sector size */
+    UINT            plug_cap;   /* Number of sectors the buffer holds */
+    UINT            plug_nr;    /* Number of held sectors */
+    ms_tick64_t     plug_since; /* Time the oldest held write came, or the last failed issue */
+    ms_uint32_t     plug_gen;   /* Changed when held sectors leave the buffer */
+    LBA_t           plug_sector[MS_FATFS_PLUG_SIZE / FF_MIN_SS];
+    ms_fatfs_mergestat_t plug_stat;
+#endif
+#if MS_FATFS_BOUNCE_NR > 0
+    ms_handle_t     bounce_sem; /* Counts the free bounce buffers */
+    ms_handle_t     bounce_lock;/* Protects the free list */
+    BYTE           *bounce_mem; /* MS_FATFS_BOUNCE_NR buffers of MS_FATFS_BOUNCE_SIZE bytes */
+    BYTE           *bounce_free[MS_FATFS_BOUNCE_NR];
+    UINT            bounce_nfree;
+    UINT            bounce_ssize;/* Sector size */
+    UINT            bounce_cap; /* Number of sectors a buffer holds, 0: do not bounce */
+#endif
+};
+
+#if FF_USE_TRIM && MS_FATFS_TRIM_QUEUE > 0
+
+/*-----------------------------------------------------------------------*/
+/* Discard Queue                                                         */
+/*-----------------------------------------------------------------------*/
+/* The sector ranges freed by FatFs are merged with the adjacent ranges in
+/  the queue and issued later by disk_discard(). A write to a queued range
+/  removes the written sectors from the queue, since a late trim would erase
+/  the new data. A range is only issued after the FAT that freed it is on
+/  the disk, so a full queue drops its shortest range instead. A successful
+/  CTRL_SYNC, made with the volume grant held, marks the ranges queued so far
+/  ready and disk_discard() issues only those, a range merged with a newer
+/  one waits for the next sync. Dropping a range is always safe, a trim is
+/  only a hint.
+*/
+
+static void trim_remove (   /* Must be called with trim_lock held */
+    struct ms_fatfs_drive *drv,
+    ms_uint32_t i       /* Index of the range */
+)
+{
+    drv->trim_nr--;
+    drv->trim_range[i][0] = drv->trim_range[drv->trim_nr][0];
+    drv->trim_range[i][1] = drv->trim_range[drv->trim_nr][1];
+    drv->trim_ready[i]    = drv->trim_ready[drv->trim_nr];
+}
+
+static void trim_issue (    /* Must be called with trim_lock held */
+    struct ms_fatfs_drive *drv
+)
+{
+    ms_uint32_t range[2];
+    ms_uint32_t i;
+
+    i = 0U;
+    while (i < drv->trim_nr) {
+        if (drv->trim_ready[i]) {
+            if ((drv->trim_range[i][1] - drv->trim_range[i][0] + 1U) >= MS_FATFS_TRIM_MIN) {
+                range[0] = drv->trim_range[i][0];
+                range[1] = drv->trim_range[i][1];
+                (void)drv->dev->drv->ops->ioctl(drv->dev->ctx, MS_NULL, MS_BLKDEV_CMD_TRIM, range);
+            }
+            trim_remove(drv, i);
+        } else {
+            i++;
+        }
+    }
+}
+
+static void trim_mark_ready (
+    struct ms_fatfs_drive *drv
+)
+{
+    ms_uint32_t i;
+
+    (void)ms_mutex_lock(drv->trim_lock, MS_TIMEOUT_FOREVER);
+    for (i = 0U; i < drv->trim_nr; i++) {
+        drv->trim_ready[i] = MS_TRUE;
+    }
+    (void)ms_mutex_unlock(drv->trim_lock);
+}
+
+static void trim_reset (
+    struct ms_fatfs_drive *drv
+)
+{
+    (void)ms_mutex_lock(drv->trim_lock, MS_TIMEOUT_FOREVER);
+    drv->trim_nr = 0U;
+    (void)ms_mutex_unlock(drv->trim_lock);
+}
+
+static void trim_queue (
+    struct ms_fatfs_drive *drv,
+    LBA_t start,        /* Start sector */
+    LBA_t end           /* End sector */
+)
+{
+    ms_uint32_t i, j;
+
+    (void)ms_mutex_lock(drv->trim_lock, MS_TIMEOUT_FOREVER);
+
+    i = 0U;
+    while (i < drv->trim_nr) {
+        if ((start <= drv->trim_range[i][1] + 1U) && (drv->trim_range[i][0] <= end + 1U)) {
+            if (drv->trim_range[i][0] < start) {    /* Merge it and look again for the grown range */
+                start = drv->trim_range[i][0];
+            }
+            if (drv->trim_range[i][1] > end) {
+                end = drv->trim_range[i][1];
+            }
+            trim_remove(drv, i);
+            i = 0U;
+        } else {
+            i++;
+        }
+    }
+
+    if (drv->trim_nr < MS_FATFS_TRIM_QUEUE) {
+        drv->trim_range[drv->trim_nr][0] = start;
+        drv->trim_range[drv->trim_nr][1] = end;
+        drv->trim_ready[drv->trim_nr]    = MS_FALSE;
+        drv->trim_nr++;
+
+    } else {                                        /* Full, drop the shortest range */
+        j = 0U;
+        for (i = 1U; i < drv->trim_nr; i++) {
+            if ((drv->trim_range[i][1] - drv->trim_range[i][0]) < (drv->trim_range[j][1] - drv->trim_range[j][0])) {
+                j = i;
+            }
+        }
+        if ((end - start) > (drv->trim_range[j][1] - drv->trim_range[j][0])) {
+            drv->trim_range[j][0] = start;
+            drv->trim_range[j][1] = end;
+            drv->trim_ready[j]    = MS_FALSE;
+        }
+    }
+
+    (void)ms_mutex_unlock(drv->trim_lock);
+}
+
+static void trim_clip (
+    struct ms_fatfs_drive *drv,
+    LBA_t sector,       /* Start sector written */
+    UINT count          /* Number of sectors written */
+)
+{
+    LBA_t end = sector + count - 1U;
+    ms_uint32_t i;
+
+    (void)ms_mutex_lock(drv->trim_lock, MS_TIMEOUT_FOREVER);
+
+    i = 0U;
+    while (i < drv->trim_nr) {
+        if ((sector > drv->trim_range[i][1]) || (end < drv->trim_range[i][0])) {
+            i++;
+
+        } else if ((sector <= drv->trim_range[i][0]) && (end >= drv->trim_range[i][1])) {
+            trim_remove(drv, i);                    /* Written over, remove it */
+
+        } else if (sector <= drv->trim_range[i][0]) {
+            drv->trim_range[i][0] = end + 1U;       /* Head written */
+            i++;
+
+        } else if (end >= drv->trim_range[i][1]) {
+            drv->trim_range[i][1] = sector - 1U;    /* Tail written */
+            i++;
+
+        } else {                                    /* Middle written, split it */
+            if (drv->trim_nr < MS_FATFS_TRIM_QUEUE) {
+                drv->trim_range[drv->trim_nr][0] = end + 1U;
+                drv->trim_range[drv->trim_nr][1] = drv->trim_range[i][1];
+                drv->trim_ready[drv->trim_nr]    = drv->trim_ready[i];
+                drv->trim_nr++;
+                drv->trim_range[i][1] = sector - 1U;
+
+            } else if ((drv->trim_range[i][1] - end) > (sector - drv->trim_range[i][0])) {
+                drv->trim_range[i][0] = end + 1U;   /* No room, keep the longer part */
+
+            } else {
+                drv->trim_range[i][1] = sector - 1U;
+            }
+            i++;
+        }
+    }
+
+    (void)ms_mutex_unlock(drv->trim_lock);
+}
+
+#endif
+
+#if MS_FATFS_PLUG_SIZE > 0
+
+/*-----------------------------------------------------------------------*/
+/* Write Merging                                                         */
+/*-----------------------------------------------------------------------*/
+/* Writes of up to plug_cap sectors are held in the plug buffer, a sector
+/  written again while held is replaced in place. The held sectors are
+/  sorted and issued as one writeblk per run of adjacent sectors when the
+/  buffer is full, by a write that comes when the oldest one is older than
+/  MS_FATFS_PLUG_AGE, on CTRL_SYNC and by disk_unplug(). A run that fails to
+/  write stays held and is issued again later, CTRL_SYNC fails while it does.
+/  A larger write or vector, or one that finds no room, replaces the held
+/  sectors it covers and goes direct. Reads go to the device without plug_lock
+/  and are patched with the held sectors after, a read that raced with held
+/  sectors leaving the buffer is done again with plug_lock held.
+*/
+
+static DRESULT plug_flush (     /* Must be called with plug_lock held */
+    struct ms_fatfs_drive *drv
+)
+{
+    ms_io_device_t *dev = drv->dev;
+    UINT ss = drv->plug_ssize;
+    BYTE *spare = drv->plug_buf + drv->plug_cap * ss;
+    DRESULT dresult = RES_OK;
+    LBA_t sector;
+    UINT i, j, k;
+    UINT nkept = 0U;
+
+    if (drv->plug_nr > 0U) {
+        drv->plug_stat.nunplug++;
+
+        for (i = 0U; i < drv->plug_nr - 1U; i++) {     /* Sort the sectors in place */
+            k = i;
+            for (j = i + 1U; j < drv->plug_nr; j++) {
+                if (drv->plug_sector[j] < drv->plug_sector[k]) {
+                    k = j;
+                }
+            }
+            if (k != i) {
+                sector = drv->plug_sector[i];
+                drv->plug_sector[i] = drv->plug_sector[k];
+                drv->plug_sector[k] = sector;
+                memcpy(spare, drv->plug_buf + i * ss, ss);
+                memcpy(drv->plug_buf + i * ss, drv->plug_buf + k * ss, ss);
+                memcpy(drv->plug_buf + k * ss, spare, ss);
+            }
+        }
+
+        for (i = 0U; i < drv->plug_nr; i = j) {         /* One writeblk per run */
+            for (j = i + 1U; (j < drv->plug_nr) && (drv->plug_sector[j] == drv->plug_sector[j - 1U] + 1U); j++) {
+            }
+            drv->plug_stat.nblk++;
+            if (dev->drv->ops->writeblk(dev->ctx, MS_NULL, drv->plug_sector[i], j - i,
+                                        drv->plug_buf + i * ss) < 0) {
+                dresult = RES_ERROR;
+                if (nkept != i) {                       /* Keep the run, packed at the front */
+                    memmove(&drv->plug_sector[nkept], &drv->plug_sector[i], (j - i) * sizeof(LBA_t));
+                    memmove(drv->plug_buf + nkept * ss, drv->plug_buf + i * ss, (j - i) * ss);
+                }
+                nkept += j - i;
+            }
+        }
+
+        if (nkept != drv->plug_nr) {
+            drv->plug_nr = nkept;
+            drv->plug_gen++;
+        }
+        if (nkept > 0U) {
+            drv->plug_since = ms_time_get();            /* Try again after another age */
+        }
+    }
+
+    return dresult;
+}
+
+static void plug_drop (         /* Must be called with plug_lock held */
+    struct ms_fatfs_drive *drv,
+    LBA_t sector,       /* Start sector written or trimmed */
+    UINT count          /* Number of sectors */
+)
+{
+    UINT ss = drv->plug_ssize;
+    UINT i = 0U;
+
+    while (i < drv->plug_nr) {
+        if ((drv->plug_sector[i] >= sector) && (drv->plug_sector[i] - sector < count)) {
+            drv->plug_nr--;
+            drv->plug_sector[i] = drv->plug_sector[drv->plug_nr];
+            memcpy(drv->plug_buf + i * ss, drv->plug_buf + drv->plug_nr * ss, ss);
+            drv->plug_gen++;
+        } else {
+            i++;
+        }
+    }
+}
+
+static UINT plug_count_new (    /* Must be called with plug_lock held */
+    struct ms_fatfs_drive *drv,
+    LBA_t sector,       /* Start sector */
+    UINT count          /* Number of sectors */
+)
+{
+    UINT nnew = 0U;
+    UINT i, k;
+
+    for (k = 0U; k < count; k++) {
+        for (i = 0U; (i < drv->plug_nr) && (drv->plug_sector[i] != sector + k); i++) {
+        }
+        if (i == drv->plug_nr) {
+            nnew++;
+        }
+    }
+
+    return nnew;
+}
+
+static void plug_write (
+    struct ms_fatfs_drive *drv,
+    const BYTE *buff,   /* Data to be written */
+    LBA_t sector,       /* Start sector */
+    UINT count,         /* Number of sectors */
+    UINT total,         /* Number of sectors in the request they belong to */
+    ms_bool_t *held     /* [out] MS_TRUE: held, MS_FALSE: to be written by the caller */
+)
+{
+    UINT ss;
+    UINT nnew = 0U;
+    UINT i, k;
+
+    (void)ms_mutex_lock(drv->plug_lock, MS_TIMEOUT_FOREVER);
+
+    ss = drv->plug_ssize;
+    drv->plug_stat.nreq++;
+    drv->plug_stat.nsect += count;
+
+    if (total <= drv->plug_cap) {
+        nnew = plug_count_new(drv, sector, count);
+        if ((drv->plug_nr + nnew) > drv->plug_cap) {
+            (void)plug_flush(drv);                      /* The failed runs are reported by CTRL_SYNC */
+            nnew = plug_count_new(drv, sector, count);
+        }
+    }
+
+    if ((total > drv->plug_cap) || ((drv->plug_nr + nnew) > drv->plug_cap)) {
+        plug_drop(drv, sector, count);
+        drv->plug_stat.nblk++;
+        *held = MS_FALSE;
+
+    } else {
+        for (k = 0U; k < count; k++) {
+            for (i = 0U; (i < drv->plug_nr) && (drv->plug_sector[i] != sector + k); i++) {
+            }
+            if (i < drv->plug_nr) {
+                drv->plug_stat.nover++;
+            } else {
+                if (drv->plug_nr == 0U) {
+                    drv->plug_since = ms_time_get();
+                }
+                i = drv->plug_nr++;
+                drv->plug_sector[i] = sector + k;
+            }
+            memcpy(drv->plug_buf + i * ss, buff + k * ss, ss);
+        }
+
+        if ((ms_time_get() - drv->plug_since) >= MS_FATFS_PLUG_AGE) {
+            (void)plug_flush(drv);
+        }
+        *held = MS_TRUE;
+    }
+
+    (void)ms_mutex_unlock(drv->plug_lock);
+}
+
+static DRESULT plug_sync (      /* RES_ERROR: some held writes could not be issued, they stay held */
+    struct ms_fatfs_drive *drv
+)
+{
+    DRESULT dresult;
+
+    (void)ms_mutex_lock(drv->plug_lock, MS_TIMEOUT_FOREVER);
+    dresult = plug_flush(drv);
+    (void)ms_mutex_unlock(drv->plug_lock);
+
+    return dresult;
+}
+
+static void plug_trim (
+    struct ms_fatfs_drive *drv,
+    LBA_t start,        /* Start sector */
+    LBA_t end           /* End sector */
+)
+{
+    (void)ms_mutex_lock(drv->plug_lock, MS_TIMEOUT_FOREVER);
+    plug_drop(drv, start, end - start + 1U);    /* Freed, no need to write them */
+    (void)ms_mutex_unlock(drv->plug_lock);
+}
+
+static void plug_setup (
+    struct ms_fatfs_drive *drv
+)
+{
+    ms_io_device_t *dev = drv->dev;
+    ms_uint32_t ss;
+
+    (void)ms_mutex_lock(drv->plug_lock, MS_TIMEOUT_FOREVER);
+
+    if (drv->plug_nr > 0U) {            /* Held for the medium before this initialization */
+        drv->plug_nr = 0U;
+        drv->plug_gen++;
+    }
+    if ((dev->drv->ops->ioctl(dev->ctx, MS_NULL, MS_BLKDEV_CMD_GET_SECT_SZ, &ss) < 0) ||
+        (ss < FF_MIN_SS) || (ss > FF_MAX_SS)) {
+        ss = 0U;                        /* Unknown sector size, do not hold writes */
+    }
+    drv->plug_ssize = ss;
+    drv->plug_cap   = (ss != 0U) ? (MS_FATFS_PLUG_SIZE / ss) : 0U;
+
+    (void)ms_mutex_unlock(drv->plug_lock);
+}
+
+static ms_bool_t plug_read_begin (  /* MS_TRUE: writes are held, call plug_read_end() after the read */
+    struct ms_fatfs_drive *drv,
+    ms_uint32_t *gen    /* [out] plug_gen before the read */
+)
+{
+    ms_bool_t held;
+
+    (void)ms_mutex_lock(drv->plug_lock, MS_TIMEOUT_FOREVER);
+    held = drv->plug_nr > 0U;
+    *gen = drv->plug_gen;
+    (void)ms_mutex_unlock(drv->plug_lock);
+
+    return held;
+}
+
+static ms_bool_t plug_read_end (    /* plug_lock is held on return, MS_FALSE: read again before plug_read_patch() */
+    struct ms_fatfs_drive *drv,
+    ms_uint32_t gen     /* plug_gen returned by plug_read_begin() */
+)
+{
+    (void)ms_mutex_lock(drv->plug_lock, MS_TIMEOUT_FOREVER);
+
+    return drv->plug_gen == gen;    /* The device may have been read before held sectors reached it */
+}
+
+static void plug_read_patch (    /* Must be called with plug_lock held */
+    struct ms_fatfs_drive *drv,
+    BYTE *buff,         /* Data read */
+    LBA_t sector,       /* Start sector */
+    UINT count          /* Number of sectors */
+)
+{
+    UINT ss = drv->plug_ssize;
+    UINT i;
+
+    for (i = 0U; i < drv->plug_nr; i++) {
+        if ((drv->plug_sector[i] >= sector) && (drv->plug_sector[i] - sector < count)) {
+            memcpy(buff + (drv->plug_sector[i] - sector) * ss, drv->plug_buf + i * ss, ss);
+            drv->plug_stat.nhit++;
+        }
+    }
+}
+
+#endif
+
+#if MS_FATFS_BOUNCE_NR > 0
+
+/*-----------------------------------------------------------------------*/
+/* Bounce Buffers                                                        */
+/*-----------------------------------------------------------------------*/
+/* The sector buffers of FatFs are aligned to MS_ARCH_CACHE_LINE_SIZE, the
+/  caller's buffer of a multi-sector f_read or f_write is not always. A
+/  transfer to a misaligned buffer is staged through an aligned bounce
+/  buffer, bounce_cap sectors at a time, so that the driver can use DMA.
+/  The cache maintenance stays in the driver, a bounce buffer spans whole
+/  cache lines and cleaning or invalidating them never hits other data.
+*/
+
+static ms_bool_t bounce_create (
+    struct ms_fatfs_drive *drv
+)
+{
+    UINT i;
+
+    drv->bounce_mem = ms_kmalloc_align(MS_FATFS_BOUNCE_NR * MS_FATFS_BOUNCE_SIZE, MS_ARCH_CACHE_LINE_SIZE);
+    if (drv->bounce_mem != MS_NULL) {
+        if (ms_mutex_create("fat_bnc", MS_WAIT_TYPE_PRIO, &drv->bounce_lock) == MS_ERR_NONE) {
+            if (ms_semc_create("fat_bncs", MS_FATFS_BOUNCE_NR, MS_FATFS_BOUNCE_NR,
+                               MS_WAIT_TYPE_PRIO, &drv->bounce_sem) == MS_ERR_NONE) {
+                for (i = 0U; i < MS_FATFS_BOUNCE_NR; i++) {
+                    drv->bounce_free[i] = drv->bounce_mem + i * MS_FATFS_BOUNCE_SIZE;
+                }
+                drv->bounce_nfree = MS_FATFS_BOUNCE_NR;
+            } else {
+                (void)ms_mutex_destroy(drv->bounce_lock);
+                (void)ms_kfree(drv->bounce_mem);
+                drv->bounce_mem = MS_NULL;
+            }
+        } else {
+            (void)ms_kfree(drv->bounce_mem);
+            drv->bounce_mem = MS_NULL;
+        }
+    }
+
+    return drv->bounce_mem != MS_NULL;
+}
+
+static void bounce_destroy (
+    struct ms_fatfs_drive *drv
+)
+{
+    (void)ms_semc_destroy(drv->bounce_sem);
+    (void)ms_mutex_destroy(drv->bounce_lock);
+    (void)ms_kfree(drv->bounce_mem);
+}
+
+static void bounce_setup (
+    struct ms_fatfs_drive *drv
+)
+{
+    ms_io_device_t *dev = drv->dev;
+    ms_uint32_t ss;
+
+    if ((dev->drv->ops->ioctl(dev->ctx, MS_NULL, MS_BLKDEV_CMD_GET_SECT_SZ, &ss) < 0) ||
+        (ss < FF_MIN_SS) || (ss > MS_FATFS_BOUNCE_SIZE)) {
+        ss = 0U;                        /* Unknown sector size, do not bounce */
+    }
+    drv->bounce_ssize = ss;
+    drv->bounce_cap   = (ss != 0U) ? (MS_FATFS_BOUNCE_SIZE / ss) : 0U;
+}
+
+static ms_bool_t bounce_need (
+    struct ms_fatfs_drive *drv,
+    const BYTE *buff    /* Data buffer of the transfer */
+)
+{
+    return (drv->bounce_cap > 0U) && ((((ms_addr_t)buff) & (MS_ARCH_CACHE_LINE_SIZE - 1U)) != 0U);
+}
+
+static BYTE *bounce_get (
+    struct ms_fatfs_drive *drv
+)
+{
+    BYTE *buf;
+
+    (void)ms_semc_wait(drv->bounce_sem, MS_TIMEOUT_FOREVER);
+    (void)ms_mutex_lock(drv->bounce_lock, MS_TIMEOUT_FOREVER);
+    buf = drv->bounce_free[--drv->bounce_nfree];
+    (void)ms_mutex_unlock(drv->bounce_lock);
+
+    return buf;
+}
+
+static void bounce_put (
+    struct ms_fatfs_drive *drv,
+    BYTE *buf
+)
+{
+    (void)ms_mutex_lock(drv->bounce_lock, MS_TIMEOUT_FOREVER);
+    drv->bounce_free[drv->bounce_nfree++] = buf;
+    (void)ms_mutex_unlock(drv->bounce_lock);
+    (void)ms_semc_post(drv->bounce_sem);
+}
+
+#endif
+
+/*-----------------------------------------------------------------------*/
+/* Transfer Sectors with the Driver                                      */
+/*-----------------------------------------------------------------------*/
+
+static int blk_xfer (   /* <0: the driver failed */
+    struct ms_fatfs_drive *drv,
+    BYTE *buff,         /* Data buffer */
+    LBA_t sector,       /* Start sector */
+    UINT count,         /* Number of sectors */
+    int wr              /* 0:read, 1:write */
+)
+{
+    ms_io_device_t *dev = drv->dev;
+    int err = 0;
+#if MS_FATFS_BOUNCE_NR > 0
+    UINT ss = drv->bounce_ssize;
+    BYTE *bounce;
+    UINT n;
+
+    if (bounce_need(drv, buff)) {
+        bounce = bounce_get(drv);
+        while ((err >= 0) && (count > 0U)) {
+            n = (count < drv->bounce_cap) ? count : drv->bounce_cap;
+            if (wr) {
+                memcpy(bounce, buff, n * ss);
+                err = dev->drv->ops->writeblk(dev->ctx, MS_NULL, sector, n, bounce);
+            } else {
+                err = dev->drv->ops->readblk(dev->ctx, MS_NULL, sector, n, bounce);
+                if (err >= 0) {
+                    memcpy(buff, bounce, n * ss);
+                }
+            }
+            buff   += n * ss;
+            sector += n;
+            count  -= n;
+        }
+        bounce_put(drv, bounce);
+
+    } else
+#endif
+    {
+        err = wr ? dev->drv->ops->writeblk(dev->ctx, MS_NULL, sector, count, buff) :
+                   dev->drv->ops->readblk(dev->ctx, MS_NULL, sector, count, buff);
+    }
+
+    return err;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Attach/Detach a Drive                                                 */
+/*-----------------------------------------------------------------------*/
+
+void *disk_attach (     /* Physical drive to set to FATFS::pdrv, NULL:Not enough memory */
+    void *dev           /* MS-RTOS block device */
+)
+{
+    struct ms_fatfs_drive *drv;
+
+    drv = ms_kzalloc(sizeof(struct ms_fatfs_drive));
+    if (drv != MS_NULL) {
+        drv->dev = (ms_io_device_t *)dev;
+#if MS_FATFS_PLUG_SIZE > 0
+        drv->plug_buf = ms_kmalloc_align(MS_FATFS_PLUG_SIZE + FF_MAX_SS, MS_ARCH_CACHE_LINE_SIZE);
+        if ((drv->plug_buf == MS_NULL) ||
+            (ms_mutex_create("fat_plug", MS_WAIT_TYPE_PRIO, &drv->plug_lock) != MS_ERR_NONE)) {
+            if (drv->plug_buf != MS_NULL) {
+                (void)ms_kfree(drv->plug_buf);
+            }
+            (void)ms_kfree(drv);
+            drv = MS_NULL;
+        }
+#endif
+#if FF_USE_TRIM && MS_FATFS_TRIM_QUEUE > 0
+        if ((drv != MS_NULL) &&
+            (ms_mutex_create("fat_trim", MS_WAIT_TYPE_PRIO, &drv->trim_lock) != MS_ERR_NONE)) {
+#if MS_FATFS_PLUG_SIZE > 0
+            (void)ms_mutex_destroy(drv->plug_lock);
+            (void)ms_kfree(drv->plug_buf);
+#endif
+            (void)ms_kfree(drv);
+            drv = MS_NULL;
+        }
+#endif
+#if MS_FATFS_BOUNCE_NR > 0
+        if ((drv != MS_NULL) && !bounce_create(drv)) {
+#if FF_USE_TRIM && MS_FATFS_TRIM_QUEUE > 0
+            (void)ms_mutex_destroy(drv->trim_lock);
+#endif
+#if MS_FATFS_PLUG_SIZE > 0
+            (void)ms_mutex_destroy(drv->plug_lock);
+            (void)ms_kfree(drv->plug_buf);
+#endif
+            (void)ms_kfree(drv);
+            drv = MS_NULL;
+        }
+#endif
+    }
+
+    return drv;
+}
+
+void disk_detach (
+    void *pdrv      /* Physical drive returned by disk_attach() */
+)
+{
+    struct ms_fatfs_drive *drv = (struct ms_fatfs_drive *)pdrv;
+
+    (void)disk_unplug(pdrv);                /* The queued discards are dropped, their FAT may not be on the disk */
+#if MS_FATFS_PLUG_SIZE > 0
+    (void)ms_mutex_destroy(drv->plug_lock);
+    (void)ms_kfree(drv->plug_buf);
+#endif
+#if FF_USE_TRIM && MS_FATFS_TRIM_QUEUE > 0
+    (void)ms_mutex_destroy(drv->trim_lock);
+#endif
+#if MS_FATFS_BOUNCE_NR > 0
+    bounce_destroy(drv);
+#endif
+    (void)ms_kfree(drv);
+}
+
+/*-----------------------------------------------------------------------*/
+/* Issue the Held Writes                                                 */
+/*-----------------------------------------------------------------------*/
+
+DRESULT disk_unplug (
+    void *pdrv      /* Physical drive nmuber to identify the drive */
+)
+{
+    DRESULT dresult = RES_OK;
+#if MS_FATFS_PLUG_SIZE > 0
+    struct ms_fatfs_drive *drv = (struct ms_fatfs_drive *)pdrv;
+
+    (void)ms_mutex_lock(drv->plug_lock, MS_TIMEOUT_FOREVER);
+    dresult = plug_flush(drv);
+    (void)ms_mutex_unlock(drv->plug_lock);
+#else
+    (void)pdrv;
+#endif
+
+    return dresult;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Get the Write Merging Statistics                                      */
+/*-----------------------------------------------------------------------*/
+
+DRESULT disk_mergestat (
+    void *pdrv,     /* Physical drive nmuber to identify the drive */
+    void *stat      /* ms_fatfs_mergestat_t to receive the statistics */
+)
+{
+#if MS_FATFS_PLUG_SIZE > 0
+    struct ms_fatfs_drive *drv = (struct ms_fatfs_drive *)pdrv;
+
+    (void)ms_mutex_lock(drv->plug_lock, MS_TIMEOUT_FOREVER);
+    *(ms_fatfs_mergestat_t *)stat = drv->plug_stat;
+    (void)ms_mutex_unlock(drv->plug_lock);
+#else
+    (void)pdrv;
+    memset(stat, 0, sizeof(ms_fatfs_mergestat_t));
+#endif
+
+    return RES_OK;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Issue the Queued Discards                                             */
+/*-----------------------------------------------------------------------*/
+
+DRESULT disk_discard (
+    void *pdrv      /* Physical drive nmuber to identify the drive */
+)
+{
+#if FF_USE_TRIM && MS_FATFS_TRIM_QUEUE > 0
+    struct ms_fatfs_drive *drv = (struct ms_fatfs_drive *)pdrv;
+
+    (void)ms_mutex_lock(drv->trim_lock, MS_TIMEOUT_FOREVER);
+    trim_issue(drv);
+    (void)ms_mutex_unlock(drv->trim_lock);
+#else
+    (void)pdrv;
+#endif
+
+    return RES_OK;
+}
+
 /*-----------------------------------------------------------------------*/
 /* Inidialize a Drive                                                    */
 /*-----------------------------------------------------------------------*/
@@ -30,13 +790,22 @@ DSTATUS disk_initialize (
     void *pdrv              /* Physical drive nmuber to identify the drive */
 )
 {
-    ms_io_device_t *dev = (ms_io_device_t *)pdrv;
+    ms_io_device_t *dev = ((struct ms_fatfs_drive *)pdrv)->dev;
     DSTATUS dstatus;
 
     if (dev->drv->ops->ioctl(dev->ctx, MS_NULL, MS_BLKDEV_CMD_INIT, MS_NULL) < 0) {
         dstatus = STA_NOINIT;
     } else {
         dstatus = 0U;
+#if FF_USE_TRIM && MS_FATFS_TRIM_QUEUE > 0
+        trim_reset((struct ms_fatfs_drive *)pdrv);      /* Queued for the medium before this initialization */
+#endif
+#if MS_FATFS_PLUG_SIZE > 0
+        plug_setup((struct ms_fatfs_drive *)pdrv);
+#endif
+#if MS_FATFS_BOUNCE_NR > 0
+        bounce_setup((struct ms_fatfs_drive *)pdrv);
+#endif
     }
 
     return dstatus;
@@ -50,7 +819,7 @@ DSTATUS disk_status (
     void *pdrv      /* Physical drive nmuber to identify the drive */
 )
 {
-    ms_io_device_t *dev = (ms_io_device_t *)pdrv;
+    ms_io_device_t *dev = ((struct ms_fatfs_drive *)pdrv)->dev;
     DSTATUS dstatus;
     ms_uint32_t ms_status;
 
@@ -95,15 +864,31 @@ DRESULT disk_read (
     UINT count      /* Number of sectors to read */
 )
 {
-    ms_io_device_t *dev = (ms_io_device_t *)pdrv;
+    struct ms_fatfs_drive *drv = (struct ms_fatfs_drive *)pdrv;
     DRESULT dresult;
+#if MS_FATFS_PLUG_SIZE > 0
+    ms_uint32_t gen;
+    ms_bool_t held = plug_read_begin(drv, &gen);
+#endif
 
-    if (dev->drv->ops->readblk(dev->ctx, MS_NULL, sector, count, buff) < 0) {
+    if (blk_xfer(drv, buff, sector, count, 0) < 0) {
         dresult = RES_ERROR;
     } else {
         dresult = RES_OK;
     }
 
+#if MS_FATFS_PLUG_SIZE > 0
+    if (held && (dresult == RES_OK)) {
+        if (!plug_read_end(drv, gen) && (blk_xfer(drv, buff, sector, count, 0) < 0)) {
+            dresult = RES_ERROR;
+        }
+        if (dresult == RES_OK) {
+            plug_read_patch(drv, buff, sector, count);
+        }
+        (void)ms_mutex_unlock(drv->plug_lock);
+    }
+#endif
+
     return dresult;
 }
 
@@ -118,18 +903,146 @@ DRESULT disk_write (
     UINT count          /* Number of sectors to write */
 )
 {
-    ms_io_device_t *dev = (ms_io_device_t *)pdrv;
-    DRESULT dresult;
+    struct ms_fatfs_drive *drv = (struct ms_fatfs_drive *)pdrv;
+    DRESULT dresult = RES_OK;
+    ms_bool_t held = MS_FALSE;
 
-    if (dev->drv->ops->writeblk(dev->ctx, MS_NULL, sector, count, buff) < 0) {
-        dresult = RES_ERROR;
-    } else {
-        dresult = RES_OK;
+#if FF_USE_TRIM && MS_FATFS_TRIM_QUEUE > 0
+    trim_clip(drv, sector, count);
+#endif
+#if MS_FATFS_PLUG_SIZE > 0
+    plug_write(drv, buff, sector, count, count, &held);
+#endif
+
+    if (!held) {
+        if (blk_xfer(drv, (BYTE *)buff, sector, count, 1) < 0) {
+            dresult = RES_ERROR;
+        }
     }
 
     return dresult;
 }
 
+#if FF_FS_SGIO
+
+/*-----------------------------------------------------------------------*/
+/* Read/Write Sector Segments                                            */
+/*-----------------------------------------------------------------------*/
+/* The segments are passed to the driver in MS_FATFS_BLKDEV_CMD_READV or
+/  MS_FATFS_BLKDEV_CMD_WRITEV requests of up to FF_FS_SGIO segments. When
+/  the driver fails the command, the segments are transferred one by one.
+*/
+
+static DRESULT disk_xferv (
+    void *pdrv,         /* Physical drive nmuber to identify the drive */
+    const DSEG *seg,    /* Segment list */
+    UINT nseg,          /* Number of segments */
+    int wr              /* 0:read, 1:write */
+)
+{
+    struct ms_fatfs_drive *drv = (struct ms_fatfs_drive *)pdrv;
+    ms_io_device_t *dev = drv->dev;
+    ms_fatfs_blkseg_t blkseg[FF_FS_SGIO];
+    ms_fatfs_blkvec_t blkvec;
+    DRESULT dresult = RES_OK;
+    ms_bool_t held = MS_FALSE;
+    UINT n, m, total;
+    UINT i;
+#if MS_FATFS_PLUG_SIZE > 0
+    const DSEG *rseg = seg;
+    UINT rnseg = nseg;
+    ms_uint32_t gen;
+    ms_bool_t rheld = !wr && plug_read_begin(drv, &gen);
+#endif
+
+    while ((dresult == RES_OK) && (nseg > 0U)) {
+        n = (nseg < FF_FS_SGIO) ? nseg : FF_FS_SGIO;
+        for (i = 0U, total = 0U; i < n; i++) {
+            total += seg[i].count;
+        }
+
+        for (i = 0U, m = 0U; (dresult == RES_OK) && (i < n); i++) {
+            if (wr) {
+#if FF_USE_TRIM && MS_FATFS_TRIM_QUEUE > 0
+                trim_clip(drv, seg[i].sector, seg[i].count);
+#endif
+#if MS_FATFS_PLUG_SIZE > 0
+                plug_write(drv, seg[i].buff, seg[i].sector, seg[i].count, total, &held);
+#endif
+            }
+            if (!held) {
+#if MS_FATFS_BOUNCE_NR > 0
+                if (bounce_need(drv, seg[i].buff)) {    /* Staged alone, out of the vector */
+                    if (blk_xfer(drv, (BYTE *)seg[i].buff, seg[i].sector, seg[i].count, wr) < 0) {
+                        dresult = RES_ERROR;
+                    }
+                } else
+#endif
+                {
+                    blkseg[m].sector = seg[i].sector;
+                    blkseg[m].count  = seg[i].count;
+                    blkseg[m].buf    = seg[i].buff;
+                    m++;
+                }
+            }
+        }
+        blkvec.seg  = blkseg;
+        blkvec.nseg = m;
+
+        if ((dresult == RES_OK) && (m > 0U) &&
+            (dev->drv->ops->ioctl(dev->ctx, MS_NULL,
+                                  wr ? MS_FATFS_BLKDEV_CMD_WRITEV : MS_FATFS_BLKDEV_CMD_READV,
+                                  &blkvec) < 0)) {
+            for (i = 0U; (dresult == RES_OK) && (i < m); i++) {
+                if (blk_xfer(drv, blkseg[i].buf, blkseg[i].sector, blkseg[i].count, wr) < 0) {
+                    dresult = RES_ERROR;
+                }
+            }
+        }
+
+        seg  += n;
+        nseg -= n;
+    }
+
+#if MS_FATFS_PLUG_SIZE > 0
+    if (rheld && (dresult == RES_OK)) {
+        if (!plug_read_end(drv, gen)) {
+            for (i = 0U; (dresult == RES_OK) && (i < rnseg); i++) {
+                if (blk_xfer(drv, rseg[i].buff, rseg[i].sector, rseg[i].count, 0) < 0) {
+                    dresult = RES_ERROR;
+                }
+            }
+        }
+        for (i = 0U; (dresult == RES_OK) && (i < rnseg); i++) {
+            plug_read_patch(drv, rseg[i].buff, rseg[i].sector, rseg[i].count);
+        }
+        (void)ms_mutex_unlock(drv->plug_lock);
+    }
+#endif
+
+    return dresult;
+}
+
+DRESULT disk_readv (
+    void *pdrv,         /* Physical drive nmuber to identify the drive */
+    const DSEG *seg,    /* Segments to read */
+    UINT nseg           /* Number of segments */
+)
+{
+    return disk_xferv(pdrv, seg, nseg, 0);
+}
+
+DRESULT disk_writev (
+    void *pdrv,         /* Physical drive nmuber to identify the drive */
+    const DSEG *seg,    /* Segments to write */
+    UINT nseg           /* Number of segments */
+)
+{
+    return disk_xferv(pdrv, seg, nseg, 1);
+}
+
+#endif
+
 /*-----------------------------------------------------------------------*/
 /* Miscellaneous Functions                                               */
 /*-----------------------------------------------------------------------*/
@@ -140,7 +1053,7 @@ DRESULT disk_ioctl (
     void *buff      /* Buffer to send/receive control data */
 )
 {
-    ms_io_device_t *dev = (ms_io_device_t *)pdrv;
+    ms_io_device_t *dev = ((struct ms_fatfs_drive *)pdrv)->dev;
     DRESULT dresult = RES_OK;
     ms_ptr_t ms_buf = buff;
     ms_uint32_t ms_value;
@@ -149,6 +1062,9 @@ DRESULT disk_ioctl (
     switch (cmd) {
     case CTRL_SYNC:
         ms_cmd = MS_BLKDEV_CMD_SYNC;
+#if MS_FATFS_PLUG_SIZE > 0
+        dresult = plug_sync((struct ms_fatfs_drive *)pdrv);
+#endif
         break;
 
     case GET_SECTOR_COUNT:
@@ -166,6 +1082,9 @@ DRESULT disk_ioctl (
 
     case CTRL_TRIM:
         ms_cmd = MS_BLKDEV_CMD_TRIM;
+#if MS_FATFS_PLUG_SIZE > 0
+        plug_trim((struct ms_fatfs_drive *)pdrv, ((LBA_t *)buff)[0], ((LBA_t *)buff)[1]);
+#endif
         break;
 
     default:
@@ -174,12 +1093,22 @@ DRESULT disk_ioctl (
     }
 
     if (dresult == RES_OK) {
+#if FF_USE_TRIM && MS_FATFS_TRIM_QUEUE > 0
+        if (cmd == CTRL_TRIM) {     /* Issued later by disk_discard() */
+            trim_queue((struct ms_fatfs_drive *)pdrv, ((LBA_t *)buff)[0], ((LBA_t *)buff)[1]);
+        } else
+#endif
         if (dev->drv->ops->ioctl(dev->ctx, MS_NULL, ms_cmd, ms_buf) < 0) {
             dresult = RES_ERROR;
         } else {
             if (ms_cmd == MS_BLKDEV_CMD_GET_SECT_SZ) {
                 *(ms_uint16_t *)buff = ms_value;
             }
+#if FF_USE_TRIM && MS_FATFS_TRIM_QUEUE > 0
+            if (cmd == CTRL_SYNC) {     /* The FAT that freed the queued ranges is on the disk */
+                trim_mark_ready((struct ms_fatfs_drive *)pdrv);
+            }
+#endif
         }
     }
 
@@ -212,6 +1141,29 @@ void ff_memfree (
 
 #endif
 
+/*------------------------------------------------------------------------*/
+/* Volume Synchronization Object                                          */
+/*------------------------------------------------------------------------*/
+/* An exclusive holder owns wlock for the whole grant and takes idle once
+/  the shared holders have drained. A shared holder passes through wlock,
+/  so it queues behind a waiting exclusive holder, and the first one in
+/  takes idle for the group while the last one out gives it back. Shared
+/  holders serialize on winlock while they use the sector window. A task
+/  transferring file data out of the grant is counted in nxfer, the first
+/  one takes xidle and the last one gives it back, so that an exclusive
+/  holder about to free clusters can wait for xidle.
+*/
+
+struct ms_fatfs_sync {
+    ms_handle_t     wlock;      /* Exclusive holder, or shared holder on entry */
+    ms_handle_t     rlock;      /* Protects nshared */
+    ms_handle_t     winlock;    /* Sector window among shared holders */
+    ms_handle_t     idle;       /* Binary semaphore, taken while the volume is held */
+    ms_handle_t     xidle;      /* Binary semaphore, taken while data transfers are out of the grant */
+    ms_uint32_t     nshared;    /* Number of shared holders */
+    ms_uint32_t     nxfer;      /* Number of data transfers out of the grant */
+};
+
 /*------------------------------------------------------------------------*/
 /* Create a Synchronization Object                                        */
 /*------------------------------------------------------------------------*/
@@ -225,12 +1177,41 @@ int ff_cre_syncobj (    /* 1:Function succeeded, 0:Could not create the sync obj
     FF_SYNC_t* sobj     /* Pointer to return the created sync object */
 )
 {
-    int ret;
+    struct ms_fatfs_sync *sync;
+    int ret = 0;
 
-    if (ms_mutex_create("fat_lock", MS_WAIT_TYPE_PRIO, sobj) == MS_ERR_NONE) {
-        ret = 1;
-    } else {
-        ret = 0;
+    sync = ms_kzalloc(sizeof(struct ms_fatfs_sync));
+    if (sync != MS_NULL) {
+        if (ms_mutex_create("fat_lock", MS_WAIT_TYPE_PRIO, &sync->wlock) == MS_ERR_NONE) {
+            if (ms_mutex_create("fat_rlock", MS_WAIT_TYPE_PRIO, &sync->rlock) == MS_ERR_NONE) {
+                if (ms_mutex_create("fat_winlock", MS_WAIT_TYPE_PRIO, &sync->winlock) == MS_ERR_NONE) {
+                    if (ms_semb_create("fat_idle", MS_TRUE, MS_WAIT_TYPE_PRIO, &sync->idle) == MS_ERR_NONE) {
+                        if (ms_semb_create("fat_xidle", MS_TRUE, MS_WAIT_TYPE_PRIO, &sync->xidle) == MS_ERR_NONE) {
+                            *sobj = sync;
+                            ret = 1;
+                        } else {
+                            (void)ms_semb_destroy(sync->idle);
+                            (void)ms_mutex_destroy(sync->winlock);
+                            (void)ms_mutex_destroy(sync->rlock);
+                            (void)ms_mutex_destroy(sync->wlock);
+                        }
+                    } else {
+                        (void)ms_mutex_destroy(sync->winlock);
+                        (void)ms_mutex_destroy(sync->rlock);
+                        (void)ms_mutex_destroy(sync->wlock);
+                    }
+                } else {
+                    (void)ms_mutex_destroy(sync->rlock);
+                    (void)ms_mutex_destroy(sync->wlock);
+                }
+            } else {
+                (void)ms_mutex_destroy(sync->wlock);
+            }
+        }
+
+        if (ret == 0) {
+            (void)ms_kfree(sync);
+        }
     }
 
     return ret;
@@ -248,14 +1229,26 @@ int ff_del_syncobj (    /* 1:Function succeeded, 0:Could not delete due to an er
     FF_SYNC_t sobj      /* Sync object tied to the logical drive to be deleted */
 )
 {
-    int ret;
+    int ret = 1;
 
-    if (ms_mutex_destroy(sobj) == MS_ERR_NONE) {
-        ret = 1;
-    } else {
+    if (ms_semb_destroy(sobj->xidle) != MS_ERR_NONE) {
+        ret = 0;
+    }
+    if (ms_semb_destroy(sobj->idle) != MS_ERR_NONE) {
+        ret = 0;
+    }
+    if (ms_mutex_destroy(sobj->winlock) != MS_ERR_NONE) {
+        ret = 0;
+    }
+    if (ms_mutex_destroy(sobj->rlock) != MS_ERR_NONE) {
+        ret = 0;
+    }
+    if (ms_mutex_destroy(sobj->wlock) != MS_ERR_NONE) {
         ret = 0;
     }
 
+    (void)ms_kfree(sobj);
+
     return ret;
 }
 
@@ -270,12 +1263,14 @@ int ff_req_grant (  /* 1:Got a grant to access the volume, 0:Could not get a gra
     FF_SYNC_t sobj  /* Sync object to wait */
 )
 {
-    int ret;
+    int ret = 0;
 
-    if (ms_mutex_lock(sobj, FF_FS_TIMEOUT) == MS_ERR_NONE) {
-        ret = 1;
-    } else {
-        ret = 0;
+    if (ms_mutex_lock(sobj->wlock, FF_FS_TIMEOUT) == MS_ERR_NONE) {
+        if (ms_semb_wait(sobj->idle, FF_FS_TIMEOUT) == MS_ERR_NONE) {   /* Wait for shared holders to drain */
+            ret = 1;
+        } else {
+            (void)ms_mutex_unlock(sobj->wlock);
+        }
     }
 
     return ret;
@@ -291,7 +1286,127 @@ void ff_rel_grant (
     FF_SYNC_t sobj  /* Sync object to be signaled */
 )
 {
-    (void)ms_mutex_unlock(sobj);
+    (void)ms_semb_post(sobj->idle);
+    (void)ms_mutex_unlock(sobj->wlock);
+}
+
+/*------------------------------------------------------------------------*/
+/* Request Shared Grant to Access the Volume                              */
+/*------------------------------------------------------------------------*/
+/* This function is called on entering f_read() to lock the volume against
+/  exclusive holders only. When a 0 is returned, f_read() fails with FR_TIMEOUT.
+*/
+
+int ff_req_grant_shared (   /* 1:Got a grant to access the volume, 0:Could not get a grant */
+    FF_SYNC_t sobj          /* Sync object to wait */
+)
+{
+    int ret = 0;
+
+    if (ms_mutex_lock(sobj->wlock, FF_FS_TIMEOUT) == MS_ERR_NONE) {
+        (void)ms_mutex_lock(sobj->rlock, MS_TIMEOUT_FOREVER);
+        if (sobj->nshared != 0U) {
+            ret = 1;
+        } else if (ms_semb_wait(sobj->idle, FF_FS_TIMEOUT) == MS_ERR_NONE) {  /* First shared holder */
+            ret = 1;
+        }
+        if (ret != 0) {
+            sobj->nshared++;
+        }
+        (void)ms_mutex_unlock(sobj->rlock);
+        (void)ms_mutex_unlock(sobj->wlock);
+    }
+
+    return ret;
+}
+
+/*------------------------------------------------------------------------*/
+/* Release Shared Grant to Access the Volume                              */
+/*------------------------------------------------------------------------*/
+
+void ff_rel_grant_shared (
+    FF_SYNC_t sobj  /* Sync object to be signaled */
+)
+{
+    (void)ms_mutex_lock(sobj->rlock, MS_TIMEOUT_FOREVER);
+    if (--sobj->nshared == 0U) {    /* Last shared holder */
+        (void)ms_semb_post(sobj->idle);
+    }
+    (void)ms_mutex_unlock(sobj->rlock);
+}
+
+/*------------------------------------------------------------------------*/
+/* Lock/Unlock the Sector Window among Shared Holders                     */
+/*------------------------------------------------------------------------*/
+
+void ff_req_window (
+    FF_SYNC_t sobj  /* Sync object to wait */
+)
+{
+    (void)ms_mutex_lock(sobj->winlock, MS_TIMEOUT_FOREVER);
+}
+
+void ff_rel_window (
+    FF_SYNC_t sobj  /* Sync object to be signaled */
+)
+{
+    (void)ms_mutex_unlock(sobj->winlock);
+}
+
+/*------------------------------------------------------------------------*/
+/* Release/Request Grant around a Data Transfer                           */
+/*------------------------------------------------------------------------*/
+/* These functions are called by f_read() and f_write() around a transfer
+/  of whole sectors between the device and the caller's buffer. The
+/  transfer is counted before the grant is released, so an exclusive holder
+/  that frees clusters afterwards sees it in ff_wait_xfer().
+*/
+
+void ff_rel_grant_xfer (
+    FF_SYNC_t sobj, /* Sync object to be signaled */
+    int shr         /* Grant held by the caller (0:exclusive, 1:shared) */
+)
+{
+    (void)ms_mutex_lock(sobj->rlock, MS_TIMEOUT_FOREVER);
+    if (sobj->nxfer++ == 0U) {      /* First transfer out of the grant */
+        (void)ms_semb_wait(sobj->xidle, MS_TIMEOUT_FOREVER);
+    }
+    (void)ms_mutex_unlock(sobj->rlock);
+
+    if (shr) {
+        ff_rel_grant_shared(sobj);
+    } else {
+        ff_rel_grant(sobj);
+    }
+}
+
+int ff_req_grant_xfer ( /* 1:Got the grant back, 0:Could not get the grant */
+    FF_SYNC_t sobj,     /* Sync object to wait */
+    int shr             /* Grant to take back (0:exclusive, 1:shared) */
+)
+{
+    (void)ms_mutex_lock(sobj->rlock, MS_TIMEOUT_FOREVER);
+    if (--sobj->nxfer == 0U) {      /* Last transfer out of the grant */
+        (void)ms_semb_post(sobj->xidle);
+    }
+    (void)ms_mutex_unlock(sobj->rlock);
+
+    return shr ? ff_req_grant_shared(sobj) : ff_req_grant(sobj);
+}
+
+/*------------------------------------------------------------------------*/
+/* Wait for Data Transfers out of the Grant                               */
+/*------------------------------------------------------------------------*/
+/* This function is called by an exclusive holder before it frees clusters.
+/  No new transfer can start while the grant is held.
+*/
+
+void ff_wait_xfer (
+    FF_SYNC_t sobj  /* Sync object to wait */
+)
+{
+    (void)ms_semb_wait(sobj->xidle, MS_TIMEOUT_FOREVER);
+    (void)ms_semb_post(sobj->xidle);
 }
 
 /*------------------------------------------------------------------------*/